@@ -0,0 +1,472 @@
+#include "AmpRack.h"
+#include "StateGuard.h"
+
+//==============================================================================
+
+static AudioProcessor::BusesProperties getRackBuses()
+{
+    AudioProcessor::BusesProperties buses;
+
+    for (int chain = 0; chain < AmpRackAudioProcessor::numChains; ++chain) {
+        const String name = "Amp " + String (chain + 1);
+        buses = buses.withInput (name, AudioChannelSet::stereo(), true)
+                     .withOutput (name, AudioChannelSet::stereo(), true);
+    }
+
+    return buses;
+}
+
+AmpRackAudioProcessor::AmpRackAudioProcessor()
+    : AudioProcessor (getRackBuses())
+    , parameters (*this)
+{
+    for (int chain = 0; chain < numChains; ++chain) {
+        const String prefix = "Amp " + String (chain + 1) + " ";
+
+        paramTypes.add (new PluginParameterComboBox (parameters, prefix + "type", getTypeItems(),
+                                                     DistortionAudioProcessor::distortionTypeFullWaveRectifier));
+        paramInputGains.add (new PluginParameterLinSlider (parameters, prefix + "input gain", "dB", -60.0f, 24.0f, 12.0f,
+                                                           [](float value){ return powf (10.0f, value * 0.05f); }));
+        paramOutputGains.add (new PluginParameterLinSlider (parameters, prefix + "output gain", "dB", -60.0f, 24.0f, -24.0f,
+                                                            [](float value){ return powf (10.0f, value * 0.05f); }));
+        paramTones.add (new PluginParameterLinSlider (parameters, prefix + "tone", "dB", -24.0f, 24.0f, 12.0f));
+    }
+
+    parameters.apvts.state = ValueTree (Identifier ("AmpRack"));
+}
+
+AmpRackAudioProcessor::~AmpRackAudioProcessor()
+{
+}
+
+const StringArray& AmpRackAudioProcessor::getTypeItems()
+{
+    static const StringArray items = [] {
+        StringArray memoryless (DistortionAudioProcessor::distortionTypeItemsUI);
+        memoryless.remove (DistortionAudioProcessor::distortionTypeDiodeClipper);
+        return memoryless;
+    }();
+
+    return items;
+}
+
+//==============================================================================
+
+void AmpRackAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+{
+    ignoreUnused (sampleRate, samplesPerBlock);
+
+    // Lay the channels of all enabled buses out as lanes
+    Array<int> channels, chains;
+
+    for (int bus = 0; bus < getBusCount (true); ++bus) {
+        const int numBusChannels = getChannelCountOfBus (true, bus);
+
+        for (int channel = 0; channel < numBusChannels && bus < numChains; ++channel) {
+            channels.add (getChannelIndexInProcessBlockBuffer (true, bus, channel));
+            chains.add (bus);
+        }
+    }
+
+    numLanes = channels.size();
+    numGroups = (numLanes + laneWidth - 1) / laneWidth;
+    const size_t numPaddedLanes = (size_t)jmax (1, numGroups * laneWidth);
+
+    arena.prepare (3 * DspArena::getRequiredBytes<int> (numPaddedLanes)
+                   + 8 * DspArena::getRequiredBytes<float> (numPaddedLanes)
+                   + DspArena::getRequiredBytes<float> ((size_t)(maxBlockSize * laneWidth)));
+
+    laneChannels = arena.allocate<int> (numPaddedLanes);
+    laneChains = arena.allocate<int> (numPaddedLanes);
+    laneTypes = arena.allocate<int> (numPaddedLanes);
+    inputGains = arena.allocate<float> (numPaddedLanes);
+    inputGainSteps = arena.allocate<float> (numPaddedLanes);
+    outputGains = arena.allocate<float> (numPaddedLanes);
+    outputGainSteps = arena.allocate<float> (numPaddedLanes);
+    toneB0 = arena.allocate<float> (numPaddedLanes);
+    toneB1 = arena.allocate<float> (numPaddedLanes);
+    toneA1 = arena.allocate<float> (numPaddedLanes);
+    toneStates = arena.allocate<float> (numPaddedLanes);
+    interleaved = arena.allocate<float> ((size_t)(maxBlockSize * laneWidth));
+
+    // Padding lanes stay silent and pass through unchanged
+    for (int lane = 0; lane < (int)numPaddedLanes; ++lane) {
+        const bool isUsed = lane < numLanes;
+        laneChannels[lane] = isUsed ? channels[lane] : -1;
+        laneChains[lane] = isUsed ? chains[lane] : -1;
+        laneTypes[lane] = -1;
+        toneB0[lane] = 1.0f;
+    }
+
+    for (auto& tone : chainTones)
+        tone = std::numeric_limits<float>::quiet_NaN();
+
+    // Start every lane at its target gains
+    updateLanes (1);
+
+    for (int lane = 0; lane < numLanes; ++lane) {
+        inputGains[lane] += inputGainSteps[lane];
+        outputGains[lane] += outputGainSteps[lane];
+    }
+
+    FloatVectorOperations::clear (inputGainSteps, (int)numPaddedLanes);
+    FloatVectorOperations::clear (outputGainSteps, (int)numPaddedLanes);
+}
+
+void AmpRackAudioProcessor::releaseResources()
+{
+}
+
+//==============================================================================
+
+void AmpRackAudioProcessor::processBlock (AudioSampleBuffer& buffer, MidiBuffer& midiMessages)
+{
+    ScopedNoDenormals noDenormals;
+    ignoreUnused (midiMessages);
+
+    const int numSamples = buffer.getNumSamples();
+
+    for (int start = 0; start < numSamples; start += maxBlockSize) {
+        const int numBlockSamples = jmin ((int)maxBlockSize, numSamples - start);
+        updateLanes (numBlockSamples);
+
+        for (int group = 0; group < numGroups; ++group) {
+            // Transpose the group's channels into registers, one lane per channel
+            for (int l = 0; l < laneWidth; ++l) {
+                const int channel = laneChannels[group * laneWidth + l];
+
+                if (channel < 0) {
+                    for (int i = 0; i < numBlockSamples; ++i)
+                        interleaved[i * laneWidth + l] = 0.0f;
+
+                    continue;
+                }
+
+                const float* samples = buffer.getReadPointer (channel, start);
+
+                for (int i = 0; i < numBlockSamples; ++i)
+                    interleaved[i * laneWidth + l] = samples[i];
+            }
+
+            processGroup (interleaved, group, numBlockSamples);
+
+            for (int l = 0; l < laneWidth; ++l) {
+                const int channel = laneChannels[group * laneWidth + l];
+
+                if (channel < 0)
+                    continue;
+
+                float* samples = buffer.getWritePointer (channel, start);
+
+                for (int i = 0; i < numBlockSamples; ++i)
+                    samples[i] = interleaved[i * laneWidth + l];
+            }
+        }
+    }
+
+    // A NaN from the host would otherwise stay in the tone filters for good
+    if (! StateGuard::sanitise (toneStates, numGroups * laneWidth))
+        FloatVectorOperations::clear (toneStates, numGroups * laneWidth);
+
+    for (int channel = getTotalNumInputChannels(); channel < getTotalNumOutputChannels(); ++channel)
+        buffer.clear (channel, 0, numSamples);
+}
+
+void AmpRackAudioProcessor::updateLanes (const int numSamples)
+{
+    const float rampScale = 1.0f / (float)jmax (1, numSamples);
+
+    for (int chain = 0; chain < numChains; ++chain) {
+        const float tone = paramTones[chain]->map (paramTones[chain]->rawValue->load());
+
+        if (tone != chainTones[chain]) {
+            chainTones[chain] = tone;
+            chainFilters[chain].updateCoefficients (M_PI * 0.01, std::pow (10.0, (double)tone * 0.05));
+        }
+    }
+
+    for (int lane = 0; lane < numLanes; ++lane) {
+        const int chain = laneChains[lane];
+        const PluginParameter& type = *paramTypes[chain];
+        const PluginParameter& inputGain = *paramInputGains[chain];
+        const PluginParameter& outputGain = *paramOutputGains[chain];
+
+        laneTypes[lane] = jlimit (0, getTypeItems().size() - 1, (int)type.map (type.rawValue->load()));
+        inputGainSteps[lane] = (inputGain.map (inputGain.rawValue->load()) - inputGains[lane]) * rampScale;
+        outputGainSteps[lane] = (outputGain.map (outputGain.rawValue->load()) - outputGains[lane]) * rampScale;
+        chainFilters[chain].getCoefficients (toneB0[lane], toneB1[lane], toneA1[lane]);
+    }
+}
+
+//==============================================================================
+
+void AmpRackAudioProcessor::processGroup (float* data, const int group, const int numSamples)
+{
+    const int offset = group * laneWidth;
+
+    Vector inputGain = Vector::fromRawArray (inputGains + offset);
+    const Vector inputGainStep = Vector::fromRawArray (inputGainSteps + offset);
+    const Vector b0 = Vector::fromRawArray (toneB0 + offset);
+    const Vector b1 = Vector::fromRawArray (toneB1 + offset);
+    const Vector a1 = Vector::fromRawArray (toneA1 + offset);
+    Vector state = Vector::fromRawArray (toneStates + offset);
+
+    for (int i = 0; i < numSamples; ++i) {
+        const Vector in = Vector::fromRawArray (data + i * laneWidth) * inputGain;
+        inputGain += inputGainStep;
+
+        const Vector out = b0 * in + state;
+        state = b1 * in - a1 * out;
+        out.copyToRawArray (data + i * laneWidth);
+    }
+
+    inputGain.copyToRawArray (inputGains + offset);
+    state.copyToRawArray (toneStates + offset);
+
+    //======================================
+
+    shapeGroup (data, group, numSamples);
+
+    //======================================
+
+    Vector outputGain = Vector::fromRawArray (outputGains + offset);
+    const Vector outputGainStep = Vector::fromRawArray (outputGainSteps + offset);
+
+    for (int i = 0; i < numSamples; ++i) {
+        (Vector::fromRawArray (data + i * laneWidth) * outputGain).copyToRawArray (data + i * laneWidth);
+        outputGain += outputGainStep;
+    }
+
+    outputGain.copyToRawArray (outputGains + offset);
+}
+
+void AmpRackAudioProcessor::shapeGroup (float* data, const int group, const int numSamples)
+{
+    const int* types = laneTypes + group * laneWidth;
+    uint32 done = 0;
+
+    for (int first = 0; first < laneWidth; ++first) {
+        const int type = types[first];
+
+        if (type < 0 || (done & (1u << first)) != 0)
+            continue;
+
+        // Every lane running this type
+        alignas (64) uint32 maskBits[laneWidth] = {};
+
+        for (int l = first; l < laneWidth; ++l) {
+            if (types[l] == type) {
+                maskBits[l] = 0xffffffffu;
+                done |= 1u << l;
+            }
+        }
+
+        const Vector::vMaskType mask = Vector::vMaskType::fromRawArray (maskBits);
+        const Vector domain = Vector::expand (DistortionAudioProcessor::getShaperDomain (type));
+        const Vector negativeDomain = Vector::expand (-DistortionAudioProcessor::getShaperDomain (type));
+        if (hasVectorForm (type)) {
+            Vector out;
+
+            for (int i = 0; i < numSamples; ++i) {
+                float* samples = data + i * laneWidth;
+                const Vector raw = Vector::fromRawArray (samples);
+
+                // NaN fails the self-comparison and is zeroed, like in the single amp
+                const Vector in = Vector::min (Vector::max (raw & Vector::equal (raw, raw), negativeDomain), domain);
+                shapeVector (type, in, out);
+
+                ((out & mask) + (raw & ~mask)).copyToRawArray (samples);
+            }
+        }
+        else {
+            // No vector form (the curve needs exp or pow): shape the lanes one by one
+            for (int i = 0; i < numSamples; ++i)
+                for (int l = 0; l < laneWidth; ++l)
+                    if (maskBits[l] != 0)
+                        data[i * laneWidth + l] = DistortionAudioProcessor::getTransferCurve (type, data[i * laneWidth + l]);
+        }
+    }
+}
+
+bool AmpRackAudioProcessor::hasVectorForm (const int distortionType) noexcept
+{
+    switch (distortionType) {
+        case DistortionAudioProcessor::distortionTypeHardClipping:
+        case DistortionAudioProcessor::distortionTypeSoftClipping:
+        case DistortionAudioProcessor::distortionTypeFullWaveRectifier:
+        case DistortionAudioProcessor::distortionTypeHalfWaveRectifier:
+        case DistortionAudioProcessor::distortionTypeArayaSuyama:
+        case DistortionAudioProcessor::distortionTypeDoidicSymmetric:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Vector versions of DistortionAudioProcessor's curves, for inputs already mapped
+// into the curve's domain. Only valid for the types hasVectorForm() accepts.
+void AmpRackAudioProcessor::shapeVector (const int distortionType, const Vector in, Vector& out) noexcept
+{
+    const Vector zero = Vector::expand (0.0f);
+    const Vector one = Vector::expand (1.0f);
+
+    auto select = [](const Vector::vMaskType mask, const Vector a, const Vector b) {
+        return (a & mask) + (b & ~mask);
+    };
+
+    switch (distortionType) {
+        case DistortionAudioProcessor::distortionTypeHardClipping:
+            out = Vector::min (Vector::max (in, Vector::expand (-0.5f)), Vector::expand (0.5f));
+            break;
+
+        case DistortionAudioProcessor::distortionTypeSoftClipping: {
+            const Vector x = Vector::abs (in);
+            const Vector knee = Vector::expand (2.0f) - Vector::expand (3.0f) * x;
+            const Vector curve = one - knee * knee * Vector::expand (1.0f / 3.0f);
+            Vector y = select (Vector::greaterThan (x, Vector::expand (1.0f / 3.0f)), curve, x + x);
+            y = select (Vector::greaterThan (x, Vector::expand (2.0f / 3.0f)), one, y) * Vector::expand (0.5f);
+            out = select (Vector::lessThan (in, zero), zero - y, y);
+            break;
+        }
+
+        case DistortionAudioProcessor::distortionTypeFullWaveRectifier:
+            out = Vector::abs (in);
+            break;
+
+        case DistortionAudioProcessor::distortionTypeHalfWaveRectifier:
+            out = Vector::max (in, zero);
+            break;
+
+        case DistortionAudioProcessor::distortionTypeArayaSuyama: {
+            const Vector third = Vector::expand (1.0f / 3.0f);
+            Vector y = in;
+
+            for (int stage = 0; stage < 3; ++stage)
+                y = y * (one - y * y * third);
+
+            out = y;
+            break;
+        }
+
+        case DistortionAudioProcessor::distortionTypeDoidicSymmetric: {
+            const Vector x = Vector::abs (in);
+            const Vector y = x + x - in * in;
+            out = select (Vector::lessThan (in, zero), zero - y, y);
+            break;
+        }
+
+        default:
+            jassertfalse;
+            out = in;
+            break;
+    }
+}
+
+//==============================================================================
+
+bool AmpRackAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
+{
+    for (int bus = 0; bus < layouts.outputBuses.size(); ++bus) {
+        const AudioChannelSet& output = layouts.getChannelSet (false, bus);
+
+        if (output != layouts.getChannelSet (true, bus))
+            return false;
+
+        if (! output.isDisabled() && output != AudioChannelSet::mono() && output != AudioChannelSet::stereo())
+            return false;
+    }
+
+    return layouts.inputBuses.size() == layouts.outputBuses.size();
+}
+
+//==============================================================================
+
+void AmpRackAudioProcessor::getStateInformation (MemoryBlock& destData)
+{
+    MemoryOutputStream stream (destData, false);
+    parameters.writeBinaryState (stream);
+}
+
+void AmpRackAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
+{
+    PluginParametersManager::readBinaryState (data, sizeInBytes,
+        [this](const String& paramID, float value){ parameters.setParameterValue (paramID, value); });
+}
+
+//==============================================================================
+
+AudioProcessorEditor* AmpRackAudioProcessor::createEditor()
+{
+    return new GenericAudioProcessorEditor (*this);
+}
+
+bool AmpRackAudioProcessor::hasEditor() const
+{
+    return true;
+}
+
+//==============================================================================
+
+const String AmpRackAudioProcessor::getName() const
+{
+    return JucePlugin_Name;
+}
+
+bool AmpRackAudioProcessor::acceptsMidi() const
+{
+    return false;
+}
+
+bool AmpRackAudioProcessor::producesMidi() const
+{
+    return false;
+}
+
+bool AmpRackAudioProcessor::isMidiEffect() const
+{
+    return false;
+}
+
+double AmpRackAudioProcessor::getTailLengthSeconds() const
+{
+    return 0.0;
+}
+
+//==============================================================================
+
+int AmpRackAudioProcessor::getNumPrograms()
+{
+    return 1;
+}
+
+int AmpRackAudioProcessor::getCurrentProgram()
+{
+    return 0;
+}
+
+void AmpRackAudioProcessor::setCurrentProgram (int index)
+{
+    ignoreUnused (index);
+}
+
+const String AmpRackAudioProcessor::getProgramName (int index)
+{
+    ignoreUnused (index);
+    return {};
+}
+
+void AmpRackAudioProcessor::changeProgramName (int index, const String& newName)
+{
+    ignoreUnused (index, newName);
+}
+
+//==============================================================================
+
+// This creates new instances of the plugin..
+AudioProcessor* JUCE_CALLTYPE createPluginFilter()
+{
+    return new AmpRackAudioProcessor();
+}
+
+//==============================================================================
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginParameter.h"
+#include "PluginProcessor.h"
+#include "DspArena.h"
+
+//==============================================================================
+
+// Several independent amp chains in one plug-in, one stereo bus each. Every
+// channel of every bus is a lane of a SIMD register, so four to eight amps run
+// through one vectorised chain: input gain, tone shelf, shaper and output gain.
+// The shaper runs once per distortion type present in a register and blends
+// the result into the lanes of that type, so chains using the same model cost
+// the same as one.
+//
+// The rack offers the memoryless curves of DistortionAudioProcessor; the
+// stateful diode clipper, the gate and the oversampling stay single-amp features.
+
+class AmpRackAudioProcessor : public AudioProcessor
+{
+public:
+    //==============================================================================
+
+    enum { numChains = 4 };
+
+    AmpRackAudioProcessor();
+    ~AmpRackAudioProcessor();
+
+    //==============================================================================
+
+    void prepareToPlay (double sampleRate, int samplesPerBlock) override;
+    void releaseResources() override;
+    void processBlock (AudioSampleBuffer&, MidiBuffer&) override;
+
+    bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
+
+    //==============================================================================
+
+    void getStateInformation (MemoryBlock& destData) override;
+    void setStateInformation (const void* data, int sizeInBytes) override;
+
+    AudioProcessorEditor* createEditor() override;
+    bool hasEditor() const override;
+
+    //==============================================================================
+
+    const String getName() const override;
+
+    bool acceptsMidi() const override;
+    bool producesMidi() const override;
+    bool isMidiEffect () const override;
+    double getTailLengthSeconds() const override;
+
+    int getNumPrograms() override;
+    int getCurrentProgram() override;
+    void setCurrentProgram (int index) override;
+    const String getProgramName (int index) override;
+    void changeProgramName (int index, const String& newName) override;
+
+    //==============================================================================
+
+    // The distortion types available in the rack
+    static const StringArray& getTypeItems();
+
+    PluginParametersManager parameters;
+
+    OwnedArray<PluginParameterComboBox> paramTypes;
+    OwnedArray<PluginParameterLinSlider> paramInputGains;
+    OwnedArray<PluginParameterLinSlider> paramOutputGains;
+    OwnedArray<PluginParameterLinSlider> paramTones;
+
+private:
+    //==============================================================================
+
+    typedef dsp::SIMDRegister<float> Vector;
+    enum { laneWidth = (int)Vector::SIMDNumElements };
+
+    void updateLanes (int numSamples);
+    void processGroup (float* data, int group, int numSamples);
+    void shapeGroup (float* data, int group, int numSamples);
+
+    static bool hasVectorForm (int distortionType) noexcept;
+    static void shapeVector (int distortionType, Vector in, Vector& out) noexcept;
+
+    //======================================
+
+    enum { maxBlockSize = 256 };
+
+    DspArena arena;
+    int numLanes = 0;
+    int numGroups = 0;
+
+    // One entry per lane, padded to whole registers
+    int* laneChannels = nullptr;
+    int* laneChains = nullptr;
+    int* laneTypes = nullptr;
+    float* inputGains = nullptr;
+    float* inputGainSteps = nullptr;
+    float* outputGains = nullptr;
+    float* outputGainSteps = nullptr;
+    float* toneB0 = nullptr;
+    float* toneB1 = nullptr;
+    float* toneA1 = nullptr;
+    float* toneStates = nullptr;
+
+    // Sample-interleaved scratch for one register's worth of lanes
+    float* interleaved = nullptr;
+
+    DistortionAudioProcessor::Filter chainFilters[numChains];
+    float chainTones[numChains];
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AmpRackAudioProcessor)
+};
+
+//==============================================================================
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "DspArena.h"
+#include "StateGuard.h"
+
+//==============================================================================
+
+// Blocking distortion of a capacitively coupled tube stage. When the input
+// drives the grid positive, grid current charges the coupling capacitor and
+// shifts the operating point negative; the charge then leaks away through the
+// grid resistor. Modelled as a fast-attack, slow-release envelope of the
+// positive input, subtracted from the signal ahead of the shaper, and a
+// coupling high-pass after it that removes the DC the shifted curve produces.
+// Wraps any shaper type. An amount of 0 bypasses the stage once the high-pass
+// has faded out, which it does gradually so the DC it removed comes back smoothly.
+
+class BiasShift
+{
+public:
+    static size_t getRequiredBytes (const int numChannels, const int maxBlockSize)
+    {
+        return DspArena::getRequiredBytes<ChannelState> ((size_t)numChannels)
+             + DspArena::getRequiredBytes<float> ((size_t)jmax (1, maxBlockSize))
+             + DspArena::getRequiredBytes<float> ((size_t)(laneWidth * jmax (1, maxBlockSize)));
+    }
+
+    // Starts settled at initialAmount, without fading anything in
+    void prepare (DspArena& arena, const double sampleRate, const int numChannels, const int maxBlockSize,
+                  const float initialAmount)
+    {
+        states = arena.allocate<ChannelState> ((size_t)numChannels);
+        envelope = arena.allocate<float> ((size_t)jmax (1, maxBlockSize));
+        interleaved = arena.allocate<float> ((size_t)(laneWidth * jmax (1, maxBlockSize)));
+        numStateChannels = numChannels;
+
+        attackCoefficient = (float)std::exp (-1.0 / (attackTime * sampleRate));
+        releaseCoefficient = (float)std::exp (-1.0 / (releaseTime * sampleRate));
+        couplingCoefficient = (float)std::exp (-MathConstants<double>::twoPi * couplingFrequency / sampleRate);
+        couplingStep = (float)(1.0 / (couplingFadeTime * sampleRate));
+        amount = initialAmount;
+        couplingMix = amount > 0.0f ? 1.0f : 0.0f;
+
+        reset();
+    }
+
+    void reset()
+    {
+        for (int channel = 0; channel < numStateChannels; ++channel)
+            states[channel] = { 0.0f, 0.0f, 0.0f };
+
+        previousAmount = amount;
+    }
+
+    bool sanitiseState() noexcept
+    {
+        bool isFinite = true;
+
+        for (int channel = 0; channel < numStateChannels; ++channel)
+            isFinite = StateGuard::sanitise (states[channel].envelope)
+                    && StateGuard::sanitise (states[channel].input)
+                    && StateGuard::sanitise (states[channel].output) && isFinite;
+
+        return isFinite;
+    }
+
+    //======================================
+
+    // Amount in [0, 1]: the fraction of the positive envelope the operating point moves by
+    void setAmount (const float newAmount) noexcept
+    {
+        if (! isActive() && newAmount > 0.0f)
+            reset();
+
+        amount = newAmount;
+    }
+
+    // Linked channels share one envelope, driven by the loudest channel, so that
+    // the bias moves all of them together and a stereo image stays in place
+    void setLinked (const bool shouldLink) noexcept
+    {
+        if (shouldLink == linked)
+            return;
+
+        linked = shouldLink;
+
+        // Each channel starts from the state the linked envelope had, and back
+        if (linked) {
+            for (int channel = 1; channel < numStateChannels; ++channel)
+                states[0].envelope = jmax (states[0].envelope, states[channel].envelope);
+        }
+        else {
+            for (int channel = 1; channel < numStateChannels; ++channel)
+                states[channel].envelope = states[0].envelope;
+        }
+    }
+
+    // Shifts the operating point ahead of the shaper. Returns false if the stage is
+    // bypassed, in which case applyCoupling() must not be called for this block.
+    bool applyBias (dsp::AudioBlock<float>& block) noexcept
+    {
+        if (! isActive())
+            return false;
+
+        // Only the high-pass is still fading out
+        if (amount == 0.0f && previousAmount == 0.0f)
+            return true;
+
+        const int numChannels = jmin ((int)block.getNumChannels(), numStateChannels);
+        const int numSamples = (int)block.getNumSamples();
+
+        if (linked && numChannels > 1) {
+            // Drive: the loudest positive excursion across channels, then one envelope for all
+            FloatVectorOperations::copy (envelope, block.getChannelPointer (0), numSamples);
+
+            for (int channel = 1; channel < numChannels; ++channel)
+                FloatVectorOperations::max (envelope, envelope, block.getChannelPointer ((size_t)channel), numSamples);
+
+            FloatVectorOperations::max (envelope, envelope, 0.0f, numSamples);
+
+            float e = states[0].envelope;
+
+            for (int i = 0; i < numSamples; ++i)
+                envelope[i] = e = track (e, envelope[i]);
+
+            states[0].envelope = e;
+
+            for (int channel = 0; channel < numChannels; ++channel)
+                subtractEnvelope (block.getChannelPointer ((size_t)channel), numSamples);
+        }
+        else {
+            // The envelope recursion is serial in time, so it runs across channels instead
+            for (int first = 0; first < numChannels; first += laneWidth)
+                applyBiasToLanes (block, first, jmin ((int)laneWidth, numChannels - first), numSamples);
+        }
+
+        previousAmount = amount;
+        return true;
+    }
+
+    // Coupling capacitor into the next stage: a first-order high-pass, faded in
+    // while the bias is shifting and back out once it stops
+    void applyCoupling (dsp::AudioBlock<float>& block) noexcept
+    {
+        const int numChannels = jmin ((int)block.getNumChannels(), numStateChannels);
+        const int numSamples = (int)block.getNumSamples();
+        const float targetMix = amount > 0.0f ? 1.0f : 0.0f;
+        float mix = couplingMix;
+
+        for (int channel = 0; channel < numChannels; ++channel) {
+            float* samples = block.getChannelPointer ((size_t)channel);
+            float x1 = states[channel].input;
+            float y1 = states[channel].output;
+            mix = couplingMix;
+
+            if (mix == 1.0f && targetMix == 1.0f) {
+                for (int i = 0; i < numSamples; ++i) {
+                    const float x = samples[i];
+                    y1 = x - x1 + couplingCoefficient * y1;
+                    x1 = x;
+                    samples[i] = y1;
+                }
+            }
+            else {
+                for (int i = 0; i < numSamples; ++i) {
+                    const float x = samples[i];
+                    y1 = x - x1 + couplingCoefficient * y1;
+                    x1 = x;
+                    mix = targetMix > mix ? jmin (targetMix, mix + couplingStep) : jmax (targetMix, mix - couplingStep);
+                    samples[i] = x + mix * (y1 - x);
+                }
+            }
+
+            states[channel].input = x1;
+            states[channel].output = y1;
+        }
+
+        couplingMix = mix;
+    }
+
+private:
+    //==============================================================================
+
+    typedef dsp::SIMDRegister<float> Vector;
+    enum { laneWidth = (int)Vector::SIMDNumElements };
+
+    struct ChannelState
+    {
+        float envelope;
+        float input;
+        float output;
+    };
+
+    static constexpr double attackTime = 2e-3;
+    static constexpr double releaseTime = 150e-3;
+    static constexpr double couplingFrequency = 20.0;
+    static constexpr double couplingFadeTime = 50e-3;
+
+    bool isActive() const noexcept
+    {
+        return amount != 0.0f || previousAmount != 0.0f || couplingMix != 0.0f;
+    }
+
+    float track (const float e, const float drive) const noexcept
+    {
+        const float coefficient = drive > e ? attackCoefficient : releaseCoefficient;
+        return drive + coefficient * (e - drive);
+    }
+
+    // Unlinked envelopes of channels [first, first + numLanes), one per lane of a SIMD register
+    void applyBiasToLanes (dsp::AudioBlock<float>& block, const int first, const int numLanes, const int numSamples) noexcept
+    {
+        alignas (64) float envelopes[laneWidth] = {};
+
+        for (int l = 0; l < laneWidth; ++l) {
+            if (l < numLanes) {
+                const float* samples = block.getChannelPointer ((size_t)(first + l));
+                envelopes[l] = states[first + l].envelope;
+
+                for (int i = 0; i < numSamples; ++i)
+                    interleaved[i * laneWidth + l] = jmax (samples[i], 0.0f);
+            }
+            else {
+                for (int i = 0; i < numSamples; ++i)
+                    interleaved[i * laneWidth + l] = 0.0f;
+            }
+        }
+
+        const Vector attackCoefficients = Vector::expand (attackCoefficient);
+        const Vector releaseCoefficients = Vector::expand (releaseCoefficient);
+        Vector e = Vector::fromRawArray (envelopes);
+
+        for (int i = 0; i < numSamples; ++i) {
+            float* frame = interleaved + i * laneWidth;
+            const Vector drive = Vector::fromRawArray (frame);
+            const Vector::vMaskType attacking = Vector::greaterThan (drive, e);
+            const Vector coefficient = (attackCoefficients & attacking) + (releaseCoefficients & ~attacking);
+
+            e = drive + coefficient * (e - drive);
+            e.copyToRawArray (frame);
+        }
+
+        e.copyToRawArray (envelopes);
+
+        for (int l = 0; l < numLanes; ++l) {
+            states[first + l].envelope = envelopes[l];
+
+            for (int i = 0; i < numSamples; ++i)
+                envelope[i] = interleaved[i * laneWidth + l];
+
+            subtractEnvelope (block.getChannelPointer ((size_t)(first + l)), numSamples);
+        }
+    }
+
+    void subtractEnvelope (float* samples, const int numSamples) const noexcept
+    {
+        if (amount == previousAmount) {
+            FloatVectorOperations::addWithMultiply (samples, envelope, -amount, numSamples);
+            return;
+        }
+
+        const float amountStep = (amount - previousAmount) / (float)jmax (1, numSamples);
+
+        for (int i = 0; i < numSamples; ++i)
+            samples[i] -= (previousAmount + amountStep * (float)i) * envelope[i];
+    }
+
+    ChannelState* states = nullptr;
+    float* envelope = nullptr;
+    float* interleaved = nullptr;   // One lane per channel, for the unlinked envelopes
+    int numStateChannels = 0;
+
+    float attackCoefficient = 0.0f;
+    float releaseCoefficient = 0.0f;
+    float couplingCoefficient = 0.0f;
+    float couplingStep = 0.0f;
+    float couplingMix = 0.0f;
+    bool linked = false;
+
+    float amount = 0.0f;
+    float previousAmount = 0.0f;
+};
+
+//==============================================================================
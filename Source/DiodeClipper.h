@@ -0,0 +1,194 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "DspArena.h"
+#include "StateGuard.h"
+
+//==============================================================================
+
+// RC lowpass into a pair of antiparallel diodes, the clipping stage of a
+// Distortion+ or Tube Screamer, after Yeh et al., "Numerical Methods for
+// Simulation of Guitar Distortion Circuits":
+//
+//     dv/dt = (u - v) / RC - 2 Is / C * sinh (v / Vt)
+//
+// discretised with the trapezoidal rule. Each sample needs the root of
+//
+//     g (v) = v (1 + k1) + k2 sinh (v / Vt) - p
+//
+// where p only depends on the input and the previous state. The K-method table
+// of v (p), precomputed in prepare(), gives the root at a fixed per-sample cost;
+// the Newton-Raphson solver refines that lookup with a capped number of
+// iterations. Starting from the previous sample instead makes Newton overshoot
+// into the exponential region on fast edges and crawl back one Vt per step.
+
+class DiodeClipper
+{
+public:
+    enum Solver
+    {
+        solverNewtonRaphson = 0,
+        solverTable
+    };
+
+    static size_t getRequiredBytes (const int numChannels, const int tableSize)
+    {
+        return DspArena::getRequiredBytes<float> ((size_t)(2 * numChannels))
+             + DspArena::getRequiredBytes<float> ((size_t)tableSize);
+    }
+
+    void prepare (DspArena& arena, const double sampleRate, const int numChannels,
+                  const int maxIterationsToUse, const int tableSizeToUse, const float inputDomain)
+    {
+        const double T = 1.0 / sampleRate;
+        k1 = T / (2.0 * R * C);
+        k2 = T * Is / C;
+
+        numStateChannels = numChannels;
+        states = arena.allocate<float> ((size_t)(2 * numChannels));
+
+        maxIterations = jmax (1, maxIterationsToUse);
+        tableSize = jmax (2, tableSizeToUse);
+        table = arena.allocate<float> ((size_t)tableSize);
+
+        // |p| <= |v (1 - k1) - k2 sinh (v / Vt)| + k1 (|u[n-1]| + |u[n]|), and the first term stays below 1 V
+        tableRange = (float)(2.0 * k1 * inputDomain + 1.0);
+        tableScale = (float)(tableSize - 1) / (2.0f * tableRange);
+
+        double v = -maxVoltage;
+
+        for (int i = 0; i < tableSize; ++i) {
+            const double p = -tableRange + 2.0 * tableRange * i / (tableSize - 1);
+            v = solve (p, v, 50);
+            table[i] = (float)v;
+        }
+
+        reset();
+    }
+
+    void reset()
+    {
+        if (states != nullptr)
+            FloatVectorOperations::clear (states, 2 * numStateChannels);
+    }
+
+    bool sanitiseState() noexcept
+    {
+        return StateGuard::sanitise (states, 2 * numStateChannels);
+    }
+
+    //======================================
+
+    void process (dsp::AudioBlock<float>& block, const Solver solver, const float inputDomain) noexcept
+    {
+        const int numChannels = jmin ((int)block.getNumChannels(), numStateChannels);
+        const int numSamples = (int)block.getNumSamples();
+
+        for (int channel = 0; channel < numChannels; ++channel) {
+            float* samples = block.getChannelPointer ((size_t)channel);
+            float& v = states[2 * channel];
+            float& previousInput = states[2 * channel + 1];
+
+            if (solver == solverTable)
+                processChannel (samples, numSamples, v, previousInput, inputDomain,
+                                [this](double p, double) { return lookup (p); });
+            else
+                processChannel (samples, numSamples, v, previousInput, inputDomain,
+                                [this](double p, double) { return solve (p, lookup (p), maxIterations); });
+        }
+    }
+
+    //======================================
+
+    // Output voltage for a constant input, where the capacitor carries no current:
+    // (u - v) / R = 2 Is sinh (v / Vt). Monotonic in v, so bisection always converges.
+    static double getStaticVoltage (const double u) noexcept
+    {
+        double low = -std::abs (u), high = std::abs (u);
+
+        for (int i = 0; i < 40; ++i) {
+            const double v = 0.5 * (low + high);
+
+            if (v + 2.0 * R * Is * std::sinh (jlimit (-maxVoltage, maxVoltage, v) / Vt) > u)
+                high = v;
+            else
+                low = v;
+        }
+
+        return 0.5 * (low + high);
+    }
+
+private:
+    //==============================================================================
+
+    template <typename Solve>
+    void processChannel (float* samples, const int numSamples, float& state, float& previousInput,
+                         const float inputDomain, Solve&& solveForVoltage) const noexcept
+    {
+        double v = state;
+        double uPrevious = previousInput;
+
+        for (int i = 0; i < numSamples; ++i) {
+            const double u = samples[i] == samples[i] ? jlimit (-inputDomain, inputDomain, samples[i]) : 0.0f;
+            const double p = v * (1.0 - k1) - k2 * std::sinh (v / Vt) + k1 * (uPrevious + u);
+
+            v = solveForVoltage (p, v);
+            uPrevious = u;
+            samples[i] = (float)v;
+        }
+
+        state = (float)v;
+        previousInput = (float)uPrevious;
+    }
+
+    double solve (const double p, double v, const int iterations) const noexcept
+    {
+        for (int i = 0; i < iterations; ++i) {
+            const double x = v / Vt;
+            const double g = v * (1.0 + k1) + k2 * std::sinh (x) - p;
+            const double dg = 1.0 + k1 + k2 / Vt * std::cosh (x);
+            const double step = g / dg;
+
+            v = jlimit (-maxVoltage, maxVoltage, v - step);
+
+            if (std::abs (step) < 1e-9)
+                break;
+        }
+
+        return v;
+    }
+
+    double lookup (const double p) const noexcept
+    {
+        const float position = jlimit (0.0f, (float)(tableSize - 1), ((float)p + tableRange) * tableScale);
+        const int index = jmin ((int)position, tableSize - 2);
+        const float fraction = position - (float)index;
+
+        return table[index] + fraction * (table[index + 1] - table[index]);
+    }
+
+    //==============================================================================
+
+    // Component values from Yeh et al.
+    static constexpr double R = 2.2e3;
+    static constexpr double C = 0.01e-6;
+    static constexpr double Is = 2.52e-9;
+    static constexpr double Vt = 45.3e-3;
+
+    // sinh stays finite well past any voltage the diodes let through
+    static constexpr double maxVoltage = 30.0 * Vt;
+
+    double k1 = 0.0;
+    double k2 = 0.0;
+
+    float* states = nullptr;
+    int numStateChannels = 0;
+    int maxIterations = 1;
+
+    float* table = nullptr;
+    int tableSize = 2;
+    float tableRange = 1.0f;
+    float tableScale = 1.0f;
+};
+
+//==============================================================================
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+
+// One aligned block of memory holding all the realtime state of a processor
+// instance: filter states, delay lines and scratch buffers. Components add up
+// what they need with getRequiredBytes(), the arena is prepared once with the
+// total, and the components then carve their pieces out of it in prepareToPlay.
+// Nothing is allocated or freed while processing.
+
+class DspArena
+{
+public:
+    enum { alignment = 64 };
+
+    template <typename Type>
+    static size_t getRequiredBytes (const size_t count) noexcept
+    {
+        static_assert (std::is_trivial<Type>::value, "The arena only holds plain data");
+        return (count * sizeof (Type) + alignment - 1) & ~(size_t)(alignment - 1);
+    }
+
+    //======================================
+
+    // Only reallocates if the arena has to grow; the contents are always zeroed
+    void prepare (const size_t numBytes)
+    {
+        if (numBytes > capacity) {
+            storage.free();
+            storage.allocate (numBytes + alignment, false);
+            capacity = numBytes;
+
+            const pointer_sized_uint address = reinterpret_cast<pointer_sized_uint> (storage.get());
+            base = reinterpret_cast<char*> ((address + alignment - 1) & ~(pointer_sized_uint)(alignment - 1));
+        }
+
+        if (base != nullptr)
+            zeromem (base, capacity);
+
+        used = 0;
+    }
+
+    template <typename Type>
+    Type* allocate (const size_t count) noexcept
+    {
+        const size_t numBytes = getRequiredBytes<Type> (count);
+        jassert (used + numBytes <= capacity); // The arena was prepared with too small a size
+
+        Type* block = reinterpret_cast<Type*> (base + used);
+        used += numBytes;
+        return block;
+    }
+
+    //======================================
+
+    size_t getNumBytesUsed() const noexcept { return used; }
+    size_t getCapacity() const noexcept { return capacity; }
+
+private:
+    //==============================================================================
+
+    HeapBlock<char> storage;
+    char* base = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+};
+
+//==============================================================================
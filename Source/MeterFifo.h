@@ -0,0 +1,50 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+
+// Single-producer, single-consumer queue of fixed-size frames, for handing
+// measurements from the audio thread to the editor. Both ends are wait-free:
+// when the editor isn't reading, push() just drops frames.
+
+template <typename Frame, int capacity>
+class MeterFifo
+{
+public:
+    bool push (const Frame& frame) noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite (1, start1, size1, start2, size2);
+
+        if (size1 + size2 == 0)
+            return false;
+
+        frames[(size_t)(size1 > 0 ? start1 : start2)] = frame;
+        fifo.finishedWrite (1);
+        return true;
+    }
+
+    bool pop (Frame& frame) noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead (1, start1, size1, start2, size2);
+
+        if (size1 + size2 == 0)
+            return false;
+
+        frame = frames[(size_t)(size1 > 0 ? start1 : start2)];
+        fifo.finishedRead (1);
+        return true;
+    }
+
+private:
+    //==============================================================================
+
+    static_assert (std::is_trivially_copyable<Frame>::value, "Frames are copied on the audio thread");
+
+    AbstractFifo fifo { capacity };
+    std::array<Frame, (size_t)capacity> frames {};
+};
+
+//==============================================================================
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "DspArena.h"
+#include "StateGuard.h"
+
+//==============================================================================
+
+// Noise gate with hysteresis and optional lookahead. Linked, the detector takes
+// the per-sample peak across all channels and one envelope drives every channel;
+// unlinked, each channel is gated on its own. The envelope, hysteresis and gain
+// recursions can't be vectorised over time, so they run across channels instead,
+// one channel per lane of a SIMD register: up to four or eight channels cost
+// the same as one. Peak detection and gain application are vector operations.
+
+class NoiseGate
+{
+public:
+    static size_t getRequiredBytes (const double sampleRate, const int numChannels, const int maxBlockSize)
+    {
+        return DspArena::getRequiredBytes<float> ((size_t)(numChannels * getLookaheadSamples (sampleRate)))
+             + DspArena::getRequiredBytes<float> ((size_t)jmax (1, maxBlockSize))
+             + DspArena::getRequiredBytes<float> ((size_t)(jmax (1, numChannels) * jmax (1, maxBlockSize)))
+             + DspArena::getRequiredBytes<float> ((size_t)(laneWidth * jmax (1, maxBlockSize)))
+             + DspArena::getRequiredBytes<Detector> ((size_t)jmax (1, numChannels));
+    }
+
+    void prepare (DspArena& arena, const double sampleRate, const int numChannels, const int maxBlockSize)
+    {
+        maxLookaheadSamples = getLookaheadSamples (sampleRate);
+        numDelayChannels = numChannels;
+        delayLine = arena.allocate<float> ((size_t)(numChannels * maxLookaheadSamples));
+
+        detectorSize = jmax (1, maxBlockSize);
+        numDetectors = jmax (1, numChannels);
+        peak = arena.allocate<float> ((size_t)detectorSize);
+        gains = arena.allocate<float> ((size_t)(numDetectors * detectorSize));
+        interleaved = arena.allocate<float> ((size_t)(laneWidth * detectorSize));
+        detectors = arena.allocate<Detector> ((size_t)numDetectors);
+
+        attackCoefficient = (float)std::exp (-1.0 / (attackTime * sampleRate));
+        releaseCoefficient = (float)std::exp (-1.0 / (releaseTime * sampleRate));
+        envelopeCoefficient = (float)std::exp (-1.0 / (envelopeTime * sampleRate));
+        holdSamples = roundToInt (holdTime * sampleRate);
+
+        reset();
+    }
+
+    void reset()
+    {
+        clearDelayLine();
+        delayPosition = 0;
+
+        for (int i = 0; i < numDetectors; ++i)
+            detectors[i] = { 0.0f, 1.0f, holdSamples, true };
+    }
+
+    // Covers the detectors only: the delay line holds input, which passes through within the lookahead
+    bool sanitiseState() noexcept
+    {
+        bool isFinite = true;
+
+        for (int i = 0; i < numDetectors; ++i)
+            isFinite = StateGuard::sanitise (detectors[i].envelope)
+                    && StateGuard::sanitise (detectors[i].gain) && isFinite;
+
+        return isFinite;
+    }
+
+    //======================================
+
+    void setParameters (const float thresholdDecibels, const float hysteresisDecibels, const bool useLookahead,
+                        const bool shouldLink = true)
+    {
+        // Each channel starts from the state the linked detector had, and back
+        if (shouldLink != linked) {
+            linked = shouldLink;
+
+            for (int i = 1; i < numDetectors; ++i)
+                detectors[i] = detectors[0];
+        }
+
+        if (thresholdDecibels != lastThreshold || hysteresisDecibels != lastHysteresis) {
+            lastThreshold = thresholdDecibels;
+            lastHysteresis = hysteresisDecibels;
+            openThreshold = Decibels::decibelsToGain (thresholdDecibels, -200.0f);
+            closeThreshold = Decibels::decibelsToGain (thresholdDecibels - hysteresisDecibels, -200.0f);
+        }
+
+        if (useLookahead != lookaheadEnabled) {
+            lookaheadEnabled = useLookahead;
+            clearDelayLine();
+        }
+    }
+
+    int getLatencySamples() const noexcept
+    {
+        return lookaheadEnabled ? maxLookaheadSamples : 0;
+    }
+
+    //======================================
+
+    // Returns true if the gate stayed fully closed for the whole block, in which
+    // case the block has been silenced and the following stages can be skipped.
+    bool process (dsp::AudioBlock<float>& block)
+    {
+        const int numChannels = jmin ((int)block.getNumChannels(), numDelayChannels);
+        const int numSamples = (int)block.getNumSamples();
+        bool closed = true;
+
+        if (numChannels == 0)
+            return false;
+
+        for (int start = 0; start < numSamples; start += detectorSize) {
+            const int numChunkSamples = jmin (detectorSize, numSamples - start);
+            dsp::AudioBlock<float> chunk = block.getSubBlock ((size_t)start, (size_t)numChunkSamples);
+
+            closed = processChunk (chunk, numChannels, numChunkSamples) && closed;
+        }
+
+        return closed;
+    }
+
+private:
+    //==============================================================================
+
+    typedef dsp::SIMDRegister<float> Vector;
+    enum { laneWidth = (int)Vector::SIMDNumElements };
+
+    struct Detector
+    {
+        float envelope;
+        float gain;
+        int holdCounter;
+        bool isOpen;
+    };
+
+    static int getLookaheadSamples (const double sampleRate)
+    {
+        return jmax (1, roundToInt (lookaheadTime * sampleRate));
+    }
+
+    void clearDelayLine()
+    {
+        if (delayLine != nullptr)
+            FloatVectorOperations::clear (delayLine, numDelayChannels * maxLookaheadSamples);
+
+        delayPosition = 0;
+    }
+
+    bool processChunk (dsp::AudioBlock<float>& block, const int numChannels, const int numSamples)
+    {
+        const int numActiveDetectors = linked ? 1 : numChannels;
+        float maxGain = 0.0f;
+        bool isOpen = false;
+
+        // Linked, the single detector sees the per-sample peak across channels
+        if (linked) {
+            FloatVectorOperations::abs (peak, block.getChannelPointer (0), numSamples);
+
+            for (int channel = 1; channel < numChannels; ++channel) {
+                FloatVectorOperations::abs (gains, block.getChannelPointer ((size_t)channel), numSamples);
+                FloatVectorOperations::max (peak, peak, gains, numSamples);
+            }
+        }
+
+        // Detectors are taken before the lookahead delay, one register's worth of channels at a time
+        for (int first = 0; first < numActiveDetectors; first += laneWidth) {
+            const int numLanes = jmin ((int)laneWidth, numActiveDetectors - first);
+
+            for (int l = 0; l < laneWidth; ++l) {
+                if (l < numLanes) {
+                    const float* samples = linked ? peak : block.getChannelPointer ((size_t)(first + l));
+
+                    for (int i = 0; i < numSamples; ++i)
+                        interleaved[i * laneWidth + l] = std::abs (samples[i]);
+                }
+                else {
+                    for (int i = 0; i < numSamples; ++i)
+                        interleaved[i * laneWidth + l] = 0.0f;
+                }
+            }
+
+            maxGain = jmax (maxGain, runDetectors (first, numLanes, numSamples));
+
+            for (int l = 0; l < numLanes; ++l) {
+                float* detectorGains = gains + (first + l) * detectorSize;
+
+                for (int i = 0; i < numSamples; ++i)
+                    detectorGains[i] = interleaved[i * laneWidth + l];
+
+                isOpen = isOpen || detectors[first + l].isOpen;
+            }
+        }
+
+        if (lookaheadEnabled)
+            delayChannels (block, numChannels, numSamples);
+
+        if (! isOpen && maxGain < closedGain) {
+            for (int d = 0; d < numActiveDetectors; ++d)
+                detectors[d].gain = 0.0f;
+
+            block.clear();
+            return true;
+        }
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            FloatVectorOperations::multiply (block.getChannelPointer ((size_t)channel),
+                                             gains + (linked ? 0 : channel) * detectorSize, numSamples);
+
+        return false;
+    }
+
+    // Envelope and hysteresis state machine of detectors [first, first + numLanes), one
+    // per lane. Turns the interleaved peaks into interleaved gains, in place, and
+    // returns the largest gain of those detectors over the chunk.
+    float runDetectors (const int first, const int numLanes, const int numSamples) noexcept
+    {
+        alignas (64) float envelopes[laneWidth] = {};
+        alignas (64) float gainValues[laneWidth] = {};
+        alignas (64) float holdCounters[laneWidth] = {};
+        alignas (64) uint32 openBits[laneWidth] = {};
+
+        // Unused lanes stay closed at zero gain
+        for (int l = 0; l < numLanes; ++l) {
+            const Detector& detector = detectors[first + l];
+            envelopes[l] = detector.envelope;
+            gainValues[l] = detector.gain;
+            holdCounters[l] = (float)detector.holdCounter;
+            openBits[l] = detector.isOpen ? 0xffffffffu : 0u;
+        }
+
+        const Vector one = Vector::expand (1.0f);
+        const Vector zero = Vector::expand (0.0f);
+        const Vector holdReset = Vector::expand ((float)holdSamples);
+        const Vector openThresholds = Vector::expand (openThreshold);
+        const Vector closeThresholds = Vector::expand (closeThreshold);
+        const Vector envelopeCoefficients = Vector::expand (envelopeCoefficient);
+        const Vector attackCoefficients = Vector::expand (attackCoefficient);
+        const Vector releaseCoefficients = Vector::expand (releaseCoefficient);
+
+        Vector envelope = Vector::fromRawArray (envelopes);
+        Vector gain = Vector::fromRawArray (gainValues);
+        Vector holdCounter = Vector::fromRawArray (holdCounters);
+        Vector::vMaskType open = Vector::vMaskType::fromRawArray (openBits);
+        Vector maxGains = gain;
+
+        for (int i = 0; i < numSamples; ++i) {
+            float* frame = interleaved + i * laneWidth;
+            envelope = Vector::max (Vector::fromRawArray (frame), envelope * envelopeCoefficients);
+
+            // Above the open threshold the gate opens and the hold restarts; an open gate
+            // below the close threshold counts the hold down and closes when it runs out
+            const Vector::vMaskType opening = Vector::greaterThan (envelope, openThresholds);
+            const Vector::vMaskType closing = open & ~opening & Vector::lessThan (envelope, closeThresholds);
+            holdCounter = select (opening, holdReset, holdCounter - (one & closing));
+            open = (open | opening) & ~(closing & Vector::lessThanOrEqual (holdCounter, zero));
+
+            gain = select (open, one - attackCoefficients * (one - gain), releaseCoefficients * gain);
+            gain.copyToRawArray (frame);
+            maxGains = Vector::max (maxGains, gain);
+        }
+
+        envelope.copyToRawArray (envelopes);
+        gain.copyToRawArray (gainValues);
+        holdCounter.copyToRawArray (holdCounters);
+        open.copyToRawArray (openBits);
+
+        alignas (64) float maxGainValues[laneWidth];
+        maxGains.copyToRawArray (maxGainValues);
+        float maxGain = 0.0f;
+
+        for (int l = 0; l < numLanes; ++l) {
+            detectors[first + l] = { envelopes[l], gainValues[l], (int)holdCounters[l], openBits[l] != 0 };
+            maxGain = jmax (maxGain, maxGainValues[l]);
+        }
+
+        return maxGain;
+    }
+
+    static Vector select (const Vector::vMaskType mask, const Vector a, const Vector b) noexcept
+    {
+        return (a & mask) + (b & ~mask);
+    }
+
+    void delayChannels (dsp::AudioBlock<float>& block, const int numChannels, const int numSamples)
+    {
+        int position = delayPosition;
+
+        for (int channel = 0; channel < numChannels; ++channel) {
+            float* samples = block.getChannelPointer ((size_t)channel);
+            float* line = delayLine + channel * maxLookaheadSamples;
+            position = delayPosition;
+
+            for (int i = 0; i < numSamples; ++i) {
+                const float in = samples[i];
+                samples[i] = line[position];
+                line[position] = in;
+
+                if (++position >= maxLookaheadSamples)
+                    position = 0;
+            }
+        }
+
+        delayPosition = position;
+    }
+
+    //==============================================================================
+
+    static constexpr double lookaheadTime = 2e-3;
+    const double attackTime = 0.5e-3;
+    const double releaseTime = 60e-3;
+    const double envelopeTime = 10e-3;
+    const double holdTime = 20e-3;
+    const float closedGain = 1e-5f;
+
+    float* delayLine = nullptr;
+    float* peak = nullptr;
+    float* gains = nullptr;
+    float* interleaved = nullptr;   // One lane per detector, for the recursions
+    Detector* detectors = nullptr;
+    int numDetectors = 0;
+    bool linked = true;
+    int numDelayChannels = 0;
+    int detectorSize = 0;
+    int maxLookaheadSamples = 1;
+    int delayPosition = 0;
+    bool lookaheadEnabled = false;
+
+    float attackCoefficient = 0.0f;
+    float releaseCoefficient = 0.0f;
+    float envelopeCoefficient = 0.0f;
+    int holdSamples = 0;
+
+    float lastThreshold = 1.0f;
+    float lastHysteresis = -1.0f;
+    float openThreshold = 0.0f;
+    float closeThreshold = 0.0f;
+};
+
+//==============================================================================
@@ -8,85 +8,97 @@
 DistortionAudioProcessorEditor::DistortionAudioProcessorEditor (DistortionAudioProcessor& p)
     : AudioProcessorEditor (&p), processor (p)
 {
-    const Array<AudioProcessorParameter*> parameters = processor.getParameters();
+    const PluginParametersManager& parameters = processor.parameters;
     int comboBoxCounter = 0;
 
-    int editorHeight = 2 * editorMargin;
-    for (int i = 0; i < parameters.size(); ++i) {
-        if (const AudioProcessorParameterWithID* parameter =
-                dynamic_cast<AudioProcessorParameterWithID*> (parameters[i])) {
+    distortionType = processor.parameters.apvts.getRawParameterValue ("distortiontype");
 
-            if (processor.parameters.parameterTypes[i] == "Slider") {
-                Slider* aSlider;
-                sliders.add (aSlider = new Slider());
+    // Everything needed is in the parameter manager's tables, so no casts or
+    // string comparisons are needed to decide which widget each parameter gets
+    int editorHeight = 2 * editorMargin + displayHeight + editorPadding;
+    for (int i = 0; i < parameters.parameterList.size(); ++i) {
+        const RangedAudioParameter* parameter = parameters.parameterList.getUnchecked (i)->parameter;
+
+        switch (parameters.parameterTypes.getUnchecked (i)) {
+            case PluginParametersManager::parameterTypeSlider: {
+                MidiLearnWidget<Slider>* aSlider;
+                sliders.add (aSlider = new MidiLearnWidget<Slider>());
+                aSlider->onMidiLearnMenu = [this, i] { showMidiLearnMenu (i); };
                 aSlider->setTextValueSuffix (parameter->label);
                 aSlider->setTextBoxStyle (Slider::TextBoxLeft,
                                           false,
                                           sliderTextEntryBoxWidth,
                                           sliderTextEntryBoxHeight);
 
-                SliderAttachment* aSliderAttachment;
-                sliderAttachments.add (aSliderAttachment =
-                    new SliderAttachment (processor.parameters.apvts, parameter->paramID, *aSlider));
+                sliderAttachments.add (new SliderAttachment (processor.parameters.apvts, parameter->paramID, *aSlider));
 
                 components.add (aSlider);
-                editorHeight += sliderHeight;
+                componentHeights.add (sliderHeight);
+                break;
             }
 
             //======================================
 
-            else if (processor.parameters.parameterTypes[i] == "ToggleButton") {
-                ToggleButton* aButton;
-                toggles.add (aButton = new ToggleButton());
+            case PluginParametersManager::parameterTypeToggle: {
+                MidiLearnWidget<ToggleButton>* aButton;
+                toggles.add (aButton = new MidiLearnWidget<ToggleButton>());
+                aButton->onMidiLearnMenu = [this, i] { showMidiLearnMenu (i); };
                 aButton->setToggleState (parameter->getDefaultValue(), dontSendNotification);
 
-                ButtonAttachment* aButtonAttachment;
-                buttonAttachments.add (aButtonAttachment =
-                    new ButtonAttachment (processor.parameters.apvts, parameter->paramID, *aButton));
+                buttonAttachments.add (new ButtonAttachment (processor.parameters.apvts, parameter->paramID, *aButton));
 
                 components.add (aButton);
-                editorHeight += buttonHeight;
+                componentHeights.add (buttonHeight);
+                break;
             }
 
             //======================================
 
-            else if (processor.parameters.parameterTypes[i] == "ComboBox") {
-                ComboBox* aComboBox;
-                comboBoxes.add (aComboBox = new ComboBox());
-                aComboBox->addListener(this);
+            case PluginParametersManager::parameterTypeComboBox: {
+                MidiLearnWidget<ComboBox>* aComboBox;
+                comboBoxes.add (aComboBox = new MidiLearnWidget<ComboBox>());
+                aComboBox->onMidiLearnMenu = [this, i] { showMidiLearnMenu (i); };
                 aComboBox->setEditableText (false);
                 aComboBox->setJustificationType (Justification::left);
-                aComboBox->addItemList (processor.parameters.comboBoxItemLists[comboBoxCounter++], 1);
+                aComboBox->addItemList (*parameters.comboBoxItemLists[comboBoxCounter++], 1);
 
-                ComboBoxAttachment* aComboBoxAttachment;
-                comboBoxAttachments.add (aComboBoxAttachment =
-                    new ComboBoxAttachment (processor.parameters.apvts, parameter->paramID, *aComboBox));
+                comboBoxAttachments.add (new ComboBoxAttachment (processor.parameters.apvts, parameter->paramID, *aComboBox));
 
                 components.add (aComboBox);
-                editorHeight += comboBoxHeight;
+                componentHeights.add (comboBoxHeight);
+                break;
             }
+        }
 
-            //======================================
+        //======================================
 
-            Label* aLabel;
-            labels.add (aLabel = new Label (parameter->name, parameter->name));
-            aLabel->attachToComponent (components.getLast(), true);
-            addAndMakeVisible (aLabel);
+        Label* aLabel;
+        labels.add (aLabel = new Label (parameter->name, parameter->name));
+        aLabel->attachToComponent (components.getLast(), true);
+        addAndMakeVisible (aLabel);
 
-            components.getLast()->setName (parameter->name);
-            components.getLast()->setComponentID (parameter->paramID);
-            addAndMakeVisible (components.getLast());
-        }
+        components.getLast()->setName (parameter->name);
+        components.getLast()->setComponentID (parameter->paramID);
+        addAndMakeVisible (components.getLast());
+
+        editorHeight += componentHeights.getLast();
     }
 
     //======================================
 
     editorHeight += components.size() * editorPadding;
     setSize (editorWidth, editorHeight);
+
+    //======================================
+
+    processor.setMeteringEnabled (true);
+    startTimerHz (refreshRate);
 }
 
 DistortionAudioProcessorEditor::~DistortionAudioProcessorEditor()
 {
+    stopTimer();
+    processor.setMeteringEnabled (false);
 }
 
 //==============================================================================
@@ -94,170 +106,224 @@ DistortionAudioProcessorEditor::~DistortionAudioProcessorEditor()
 void DistortionAudioProcessorEditor::paint (Graphics& g)
 {
     g.fillAll (getLookAndFeel().findColour (ResizableWindow::backgroundColourId));
+
+    if (g.clipRegionIntersects (curveBounds))
+        paintTransferCurve (g);
+
+    if (g.clipRegionIntersects (scopeBounds))
+        paintScope (g);
+
+    if (g.clipRegionIntersects (meterBounds))
+        paintMeters (g);
 }
 
 void DistortionAudioProcessorEditor::resized()
 {
     Rectangle<int> r = getLocalBounds().reduced (editorMargin);
-    r = r.removeFromRight (r.getWidth() - labelWidth);
 
-    for (int i = 0; i < components.size(); ++i) {
-        if (Slider* aSlider = dynamic_cast<Slider*> (components[i]))
-            components[i]->setBounds (r.removeFromTop (sliderHeight));
+    Rectangle<int> display = r.removeFromTop (displayHeight);
+    r.removeFromTop (editorPadding);
 
-        if (ToggleButton* aButton = dynamic_cast<ToggleButton*> (components[i]))
-            components[i]->setBounds (r.removeFromTop (buttonHeight));
+    curveBounds = display.removeFromLeft (displayHeight);
+    display.removeFromLeft (editorPadding);
+    meterBounds = display.removeFromRight (2 * meterWidth + editorPadding);
+    display.removeFromRight (editorPadding);
+    scopeBounds = display;
+    updateCurvePath();
 
-        if (ComboBox* aComboBox = dynamic_cast<ComboBox*> (components[i]))
-            components[i]->setBounds (r.removeFromTop (comboBoxHeight));
+    r = r.removeFromRight (r.getWidth() - labelWidth);
 
+    for (int i = 0; i < components.size(); ++i) {
+        components[i]->setBounds (r.removeFromTop (componentHeights[i]));
         r = r.removeFromBottom (r.getHeight() - editorPadding);
     }
 }
 
 //==============================================================================
 
-void DistortionAudioProcessorEditor::lockInputSlider()
+void DistortionAudioProcessorEditor::showMidiLearnMenu (const int parameterIndex)
 {
-    for (int i = 0 ;i <= components.size() - 1; i++) {
-      
-        Component* parameter = components[i];
-        
-        if (parameter->getName() == "Input gain") {
-            Slider* aSlider = dynamic_cast<Slider*> (components[i]);
-            
-            aSlider->setRange(-60.0f, 6.0f);
-            aSlider->setValue(0.0f);
+    const int controller = processor.getMidiController (parameterIndex);
 
-        }
-        
-        if (parameter->getName() == "Tone") {
-            Slider* aSlider = dynamic_cast<Slider*> (components[i]);
-            
-            aSlider->setRange(-24.0f, 8.0f);
-            aSlider->setValue(8.0);
-        }
-    }
-}
+    PopupMenu menu;
+    menu.addItem (1, "MIDI learn");
+    menu.addItem (2, controller >= 0 ? "Clear MIDI mapping (CC " + String (controller) + ")"
+                                     : String ("Clear MIDI mapping"), controller >= 0);
 
-void DistortionAudioProcessorEditor::stdInputSlider()
-{
-    for (int i = 0 ;i <= components.size() - 1; i++) {
-        
-        Component* parameter = components[i];
-        
-        if (parameter->getName() == "Input gain") {
-            Slider* aSlider = dynamic_cast<Slider*> (components[i]);
-            
-            aSlider->setRange(-60.0f, 24.0f);
-            aSlider->setValue(12.0f);
+    DistortionAudioProcessor* p = &processor;
 
-        }
-    }
+    menu.showMenuAsync (PopupMenu::Options(), [p, parameterIndex](int result) {
+        if (result == 1)
+            p->startMidiLearn (parameterIndex);
+        else if (result == 2)
+            p->clearMidiMapping (parameterIndex);
+    });
 }
 
-void DistortionAudioProcessorEditor::doidicSymInputSlider()
+//==============================================================================
+
+void DistortionAudioProcessorEditor::timerCallback()
 {
-    for (int i = 0 ;i <= components.size() - 1; i++) {
-        
-        Component* parameter = components[i];
-        
-        if (parameter->getName() == "Input gain") {
-            Slider* aSlider = dynamic_cast<Slider*> (components[i]);
-            
-            aSlider->setRange(-60.0f, 21.5836f);
-            aSlider->setValue(0);
-        }
-        
-        if (parameter->getName() == "Tone") {
-            Slider* aSlider = dynamic_cast<Slider*> (components[i]);
-            
-            aSlider->setValue(12.0);
-        }
+    DistortionAudioProcessor::MeterFrame frame;
+    float newDrivePeak = 0.0f, newOutputPeak = 0.0f;
+    double driveSquares = 0.0, outputSquares = 0.0;
+    int numSamples = 0;
+    bool scopeChanged = false;
+
+    while (processor.popMeterFrame (frame)) {
+        newDrivePeak = jmax (newDrivePeak, frame.drivePeak);
+        newOutputPeak = jmax (newOutputPeak, frame.outputPeak);
+        driveSquares += frame.driveSquares;
+        outputSquares += frame.outputSquares;
+        numSamples += frame.numSamples;
+
+        scopeMin[scopePosition] = frame.outputMin;
+        scopeMax[scopePosition] = frame.outputMax;
+        scopePosition = (scopePosition + 1) % scopeSize;
+        scopeChanged = true;
     }
-}
 
-void DistortionAudioProcessorEditor::doidicAssyInputSlider()
-{
-    for (int i = 0 ;i <= components.size() - 1; i++) {
-        
-        Component* parameter = components[i];
-        
-        if (parameter->getName() == "Input gain") {
-            Slider* aSlider = dynamic_cast<Slider*> (components[i]);
-            
-            aSlider->setRange(-60.0f, 0.0f);
-            aSlider->setValue(-12.0f);
-        }
-        
-        if (parameter->getName() == "Tone") {
-            Slider* aSlider = dynamic_cast<Slider*> (components[i]);
-            
-            aSlider->setValue(12.0);
-        }
+    // Levels rise instantly and fall at a fixed rate
+    auto fall = [this](float& level, const float newLevel) {
+        const float previous = level;
+        level = jmax (Decibels::gainToDecibels (newLevel, -100.0f), level - meterFallPerTick, -100.0f);
+        return std::abs (level - previous) > 0.05f && jmax (level, previous) > meterMinDecibels;
+    };
+
+    const float count = (float)jmax (1, numSamples);
+    bool metersChanged = fall (driveLevel, std::sqrt ((float)driveSquares / count));
+    metersChanged = fall (drivePeak, newDrivePeak) || metersChanged;
+    metersChanged = fall (outputLevel, std::sqrt ((float)outputSquares / count)) || metersChanged;
+    metersChanged = fall (outputPeak, newOutputPeak) || metersChanged;
+
+    if (metersChanged)
+        repaint (meterBounds);
+
+    if (scopeChanged)
+        repaint (scopeBounds);
+
+    //======================================
+
+    const float drivePeakGain = Decibels::decibelsToGain (drivePeak, -100.0f);
+
+    if ((int)distortionType->load() != curveType) {
+        updateCurvePath();
+        repaint (curveBounds);
+    }
+    else if (std::abs (drivePeakGain - curveDrivePeak) > 0.01f * curveInputRange) {
+        repaint (curveBounds);
     }
 }
 
-void DistortionAudioProcessorEditor::comboBoxChanged (ComboBox *comboBoxThatHasChanged)
+void DistortionAudioProcessorEditor::updateCurvePath()
 {
-    for (int i = 0 ;i <= components.size() - 1; i++)
-    {
-        
-        Component* parameter = components[i];
-        
-        if (parameter->getName() == "Distortion type")
-        {
-            ComboBox* aComboBox = dynamic_cast<ComboBox*> (components[i]);
-            
-            if (comboBoxThatHasChanged == aComboBox)
-            {
-                
-              if(comboBoxThatHasChanged->getSelectedItemIndex() == 5)
-              {
-                  lockInputSlider();
-              }
-              else if (comboBoxThatHasChanged->getSelectedItemIndex() == 6 )
-              {
-                  doidicSymInputSlider();
-              }
-             else if (comboBoxThatHasChanged->getSelectedItemIndex() == 7)
-             {
-                 doidicAssyInputSlider();
-             }
-              else
-              {
-                  stdInputSlider();
-              }
-                
-            }
-        }
+    curveType = (int)distortionType->load();
+    curvePath.clear();
+
+    const Rectangle<float> area = curveBounds.toFloat().reduced (2.0f);
+    float values[curveResolution];
+    float maxValue = 1.0e-3f;
+
+    for (int i = 0; i < curveResolution; ++i) {
+        const float in = curveInputRange * (2.0f * i / (curveResolution - 1) - 1.0f);
+        values[i] = DistortionAudioProcessor::getTransferCurve (curveType, in);
+        maxValue = jmax (maxValue, std::abs (values[i]));
     }
-    
-   
-    
-    
-}
 
+    for (int i = 0; i < curveResolution; ++i) {
+        const float x = area.getX() + area.getWidth() * i / (curveResolution - 1);
+        const float y = area.getCentreY() - 0.5f * area.getHeight() * values[i] / maxValue;
 
+        if (i == 0)
+            curvePath.startNewSubPath (x, y);
+        else
+            curvePath.lineTo (x, y);
+    }
+}
 
+//==============================================================================
 
+void DistortionAudioProcessorEditor::paintTransferCurve (Graphics& g)
+{
+    const Rectangle<float> area = curveBounds.toFloat();
+    const Colour trace = getLookAndFeel().findColour (Slider::thumbColourId);
 
+    g.setColour (Colours::black.withAlpha (0.3f));
+    g.fillRect (area);
 
+    g.setColour (Colours::white.withAlpha (0.15f));
+    g.drawHorizontalLine ((int)area.getCentreY(), area.getX(), area.getRight());
+    g.drawVerticalLine ((int)area.getCentreX(), area.getY(), area.getBottom());
 
+    // The part of the curve the input is currently driving
+    curveDrivePeak = Decibels::decibelsToGain (drivePeak, -100.0f);
+    const float driveWidth = area.getWidth() * jmin (curveDrivePeak / curveInputRange, 1.0f);
 
+    g.setColour (trace.withAlpha (0.2f));
+    g.fillRect (area.withSizeKeepingCentre (driveWidth, area.getHeight()));
 
+    g.setColour (trace);
+    g.strokePath (curvePath, PathStrokeType (1.5f));
+}
 
+void DistortionAudioProcessorEditor::paintScope (Graphics& g)
+{
+    const Rectangle<float> area = scopeBounds.toFloat();
+    const float columnWidth = area.getWidth() / scopeSize;
+    const float halfHeight = 0.5f * area.getHeight();
 
+    g.setColour (Colours::black.withAlpha (0.3f));
+    g.fillRect (area);
 
+    g.setColour (getLookAndFeel().findColour (Slider::thumbColourId));
 
+    for (int i = 0; i < scopeSize; ++i) {
+        const int column = (scopePosition + i) % scopeSize;
+        const float top = area.getCentreY() - halfHeight * jlimit (-1.0f, 1.0f, scopeMax[column]);
+        const float bottom = area.getCentreY() - halfHeight * jlimit (-1.0f, 1.0f, scopeMin[column]);
 
+        g.fillRect (area.getX() + i * columnWidth, top, columnWidth, jmax (1.0f, bottom - top));
+    }
+}
 
+void DistortionAudioProcessorEditor::paintMeters (Graphics& g)
+{
+    Rectangle<float> area = meterBounds.toFloat();
 
+    paintMeter (g, area.removeFromLeft ((float)meterWidth), driveLevel, drivePeak, "In");
+    area.removeFromLeft ((float)editorPadding);
+    paintMeter (g, area.removeFromLeft ((float)meterWidth), outputLevel, outputPeak, "Out");
+}
 
+void DistortionAudioProcessorEditor::paintMeter (Graphics& g, Rectangle<float> area,
+                                                 const float levelDecibels, const float peakDecibels,
+                                                 const String& name)
+{
+    g.setColour (getLookAndFeel().findColour (Label::textColourId));
+    g.setFont (10.0f);
+    g.drawText (name, area.removeFromBottom (12.0f), Justification::centred);
 
+    g.setColour (Colours::black.withAlpha (0.3f));
+    g.fillRect (area);
 
+    auto toY = [&](const float decibels) {
+        const float proportion = (decibels - meterMinDecibels) / (meterMaxDecibels - meterMinDecibels);
+        return area.getBottom() - area.getHeight() * jlimit (0.0f, 1.0f, proportion);
+    };
 
+    const float levelY = toY (levelDecibels);
+    const float zeroY = toY (0.0f);
 
+    g.setColour (Colours::green.withAlpha (0.8f));
+    g.fillRect (area.withTop (jmax (levelY, zeroY)));
 
+    if (levelY < zeroY) {
+        g.setColour (Colours::red.withAlpha (0.8f));
+        g.fillRect (area.withTop (levelY).withBottom (zeroY));
+    }
 
+    g.setColour (peakDecibels > 0.0f ? Colours::red : Colours::white);
+    g.fillRect (area.withTop (toY (peakDecibels)).withHeight (1.5f));
+}
 
+//==============================================================================
@@ -2,13 +2,54 @@
 
 #pragma once
 
-#include "../JuceLibraryCode/JuceHeader.h"
+#include <JuceHeader.h>
 #include "PluginProcessor.h"
 
 //==============================================================================
 
+// A parameter widget whose popup-menu clicks (right-click, or ctrl-click on the
+// Mac) open the MIDI learn menu instead of reaching the widget, so that starting
+// MIDI learn doesn't move a slider to the click or flip a toggle. The drag and
+// release of that click are swallowed too.
+
+template <class WidgetType>
+class MidiLearnWidget : public WidgetType
+{
+public:
+    std::function<void()> onMidiLearnMenu;
+
+    void mouseDown (const MouseEvent& e) override
+    {
+        isPopupClick = e.mods.isPopupMenu();
+
+        if (! isPopupClick)
+            WidgetType::mouseDown (e);
+        else if (onMidiLearnMenu != nullptr)
+            onMidiLearnMenu();
+    }
+
+    void mouseDrag (const MouseEvent& e) override
+    {
+        if (! isPopupClick)
+            WidgetType::mouseDrag (e);
+    }
+
+    void mouseUp (const MouseEvent& e) override
+    {
+        if (! isPopupClick)
+            WidgetType::mouseUp (e);
+
+        isPopupClick = false;
+    }
+
+private:
+    bool isPopupClick = false;
+};
+
+//==============================================================================
+
 class DistortionAudioProcessorEditor : public AudioProcessorEditor,
-public ComboBox::Listener
+                                       private Timer
 {
 public:
     //==============================================================================
@@ -20,19 +61,26 @@ public:
 
     void paint (Graphics&) override;
     void resized() override;
-    void comboBoxChanged (ComboBox *comboBoxThatHasChanged) override;
-
-    void lockInputSlider(); //Sets the input slider range between (-60.0, 7.6) dBs, to ensure that distortionTypeArayaSuyama dont overload.
-    void stdInputSlider();  //Sets the input slider range back to (-60.0, 24.0)dBs, where all the others distortion types should work fine
-    void doidicSymInputSlider();  //Sets the input slider range between (-60.0, 23.52) dBs, to ensure that doidicSym distortion dont overload
-     void doidicAssyInputSlider();  //Sets the input slider range between (-60.0, 0) dBs, to ensure that tha the input signal never exceed the range  of work of the doidic Assymetric distortion namely [-1,1]
 
-    
 private:
     //==============================================================================
 
     DistortionAudioProcessor& processor;
 
+    void showMidiLearnMenu (int parameterIndex);
+
+    //======================================
+
+    // Meters, output scope and transfer curve, fed from the processor's meter FIFO.
+    // The timer only repaints the parts whose contents changed.
+    void timerCallback() override;
+    void updateCurvePath();
+
+    void paintTransferCurve (Graphics& g);
+    void paintScope (Graphics& g);
+    void paintMeters (Graphics& g);
+    void paintMeter (Graphics& g, Rectangle<float> area, float levelDecibels, float peakDecibels, const String& name);
+
     enum {
         editorWidth = 500,
         editorMargin = 10,
@@ -44,16 +92,42 @@ private:
         buttonHeight = 25,
         comboBoxHeight = 25,
         labelWidth = 100,
+
+        displayHeight = 150,
+        meterWidth = 20,
+        refreshRate = 30,
+        scopeSize = 256,
+        curveResolution = 129,
     };
 
+    const float curveInputRange = 2.0f;
+    const float meterMinDecibels = -60.0f;
+    const float meterMaxDecibels = 6.0f;
+    const float meterFallPerTick = 1.5f;
+
+    Rectangle<int> curveBounds, scopeBounds, meterBounds;
+
+    std::atomic<float>* distortionType = nullptr;
+    int curveType = -1;
+    Path curvePath;
+    float curveDrivePeak = 0.0f;
+
+    float scopeMin[scopeSize] = {};
+    float scopeMax[scopeSize] = {};
+    int scopePosition = 0;
+
+    float driveLevel = -100.0f, drivePeak = -100.0f;
+    float outputLevel = -100.0f, outputPeak = -100.0f;
+
     //======================================
 
-    OwnedArray<Slider> sliders;
-    OwnedArray<ToggleButton> toggles;
-    OwnedArray<ComboBox> comboBoxes;
+    OwnedArray<MidiLearnWidget<Slider>> sliders;
+    OwnedArray<MidiLearnWidget<ToggleButton>> toggles;
+    OwnedArray<MidiLearnWidget<ComboBox>> comboBoxes;
 
     OwnedArray<Label> labels;
     Array<Component*> components;
+    Array<int> componentHeights;
 
     typedef AudioProcessorValueTreeState::SliderAttachment SliderAttachment;
     typedef AudioProcessorValueTreeState::ButtonAttachment ButtonAttachment;
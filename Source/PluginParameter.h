@@ -22,9 +22,15 @@
 
 #pragma once
 
-#include "../JuceLibraryCode/JuceHeader.h"
+#include <JuceHeader.h>
 using Parameter = AudioProcessorValueTreeState::Parameter;
 
+class PluginParameter;
+
+// Maps a plain parameter value to the value the DSP works with, e.g. decibels to gain.
+// A plain function pointer: captureless lambdas convert to it, and it costs nothing to copy.
+typedef float (*ValueMapping) (float);
+
 //==============================================================================
 
 class PluginParametersManager
@@ -34,41 +40,123 @@ public:
     {
     }
 
+    //======================================
+
+    // Binary state layout: magic, version, then a table of (parameter ID, value) pairs.
+    // Values are stored unnormalised and keyed by ID, so parameters can be added or
+    // reordered without breaking old sessions. Newer versions only append sections
+    // after the table, which older readers simply ignore.
+    // Version 2: the processor appends its MIDI controller mappings.
+
+    enum
+    {
+        binaryStateMagic = 0x42545344, // "DSTB"
+        binaryStateVersion = 2
+    };
+
+    void writeBinaryState (OutputStream& stream) const
+    {
+        stream.writeInt (binaryStateMagic);
+        stream.writeInt (binaryStateVersion);
+        stream.writeCompressedInt (parameterIDs.size());
+
+        for (auto& paramID : parameterIDs) {
+            stream.writeString (paramID);
+            stream.writeFloat (apvts.getRawParameterValue (paramID)->load());
+        }
+    }
+
+    // Returns the state version, or 0 if the stream does not hold a binary state
+    template <typename Callback>
+    static int readBinaryState (InputStream& stream, Callback&& callback)
+    {
+        if (stream.getNumBytesRemaining() < 8 || stream.readInt() != binaryStateMagic)
+            return 0;
+
+        const int version = stream.readInt();
+
+        if (version < 1)
+            return 0;
+
+        const int numParameters = stream.readCompressedInt();
+
+        for (int i = 0; i < numParameters && ! stream.isExhausted(); ++i) {
+            const String paramID = stream.readString();
+            const float value = stream.readFloat();
+            callback (paramID, value);
+        }
+
+        return version;
+    }
+
+    template <typename Callback>
+    static bool readBinaryState (const void* data, int sizeInBytes, Callback&& callback)
+    {
+        if (data == nullptr || sizeInBytes <= 0)
+            return false;
+
+        MemoryInputStream stream (data, (size_t)sizeInBytes, false);
+        return readBinaryState (stream, callback) > 0;
+    }
+
+    void setParameterValue (const String& paramID, const float value)
+    {
+        if (RangedAudioParameter* parameter = apvts.getParameter (paramID))
+            parameter->setValueNotifyingHost (parameter->convertTo0to1 (value));
+    }
+
+    //======================================
+
+    enum ParameterType
+    {
+        parameterTypeSlider = 0,
+        parameterTypeToggle,
+        parameterTypeComboBox
+    };
+
     AudioProcessorValueTreeState apvts;
-    StringArray parameterTypes;
-    Array<StringArray> comboBoxItemLists;
+    Array<PluginParameter*> parameterList;
+    StringArray parameterIDs;
+    Array<ParameterType> parameterTypes;
+    Array<const StringArray*> comboBoxItemLists;
 };
 
 //==============================================================================
 
+// Describes one parameter and gives the audio thread direct access to its
+// value. Nothing here is called back when the value changes: the processor
+// reads the atomics once per block and does its own smoothing.
+
 class PluginParameter
-    : public LinearSmoothedValue<float>
-    , public AudioProcessorValueTreeState::Listener
 {
 protected:
     PluginParameter (PluginParametersManager& parametersManager,
-                     const std::function<float (float)> callback = nullptr)
+                     const ValueMapping callback = nullptr)
         : parametersManager (parametersManager)
         , callback (callback)
+        , index (parametersManager.parameterList.size())
     {
+        parametersManager.parameterList.add (this);
     }
 
-public:
-    void updateValue (float value)
+    void registerParameter (RangedAudioParameter* newParameter)
     {
-        if (callback != nullptr)
-            setCurrentAndTargetValue (callback (value));
-        else
-            setCurrentAndTargetValue (value);
+        parameter = newParameter;
+        rawValue = parametersManager.apvts.getRawParameterValue (paramID);
     }
 
-    void parameterChanged (const String& parameterID, float newValue) override
+public:
+    // Converts a plain parameter value into the value the DSP works with
+    float map (const float value) const
     {
-        updateValue (newValue);
+        return callback != nullptr ? callback (value) : value;
     }
 
     PluginParametersManager& parametersManager;
-    std::function<float (float)> callback;
+    const ValueMapping callback;
+    const int index;
+    RangedAudioParameter* parameter = nullptr;
+    std::atomic<float>* rawValue = nullptr;
     String paramID;
 };
 
@@ -83,7 +171,7 @@ protected:
                            const float minValue,
                            const float maxValue,
                            const float defaultValue,
-                           const std::function<float (float)> callback,
+                           const ValueMapping callback,
                            const bool logarithmic)
         : PluginParameter (parametersManager, callback)
         , paramName (paramName)
@@ -93,21 +181,19 @@ protected:
         , defaultValue (defaultValue)
     {
         paramID = paramName.removeCharacters (" ").toLowerCase();
-        parametersManager.parameterTypes.add ("Slider");
+        parametersManager.parameterIDs.add (paramID);
+        parametersManager.parameterTypes.add (PluginParametersManager::parameterTypeSlider);
 
         NormalisableRange<float> range (minValue, maxValue);
         
         if (logarithmic)
             range.setSkewForCentre (sqrt (minValue * maxValue));
 
-        parametersManager.apvts.createAndAddParameter (std::make_unique<Parameter>
+        registerParameter (parametersManager.apvts.createAndAddParameter (std::make_unique<Parameter>
             (paramID, paramName, labelText, range, defaultValue,
              [](float value){ return String (value, 2); },
              [](const String& text){ return text.getFloatValue(); })
-        );
-
-        parametersManager.apvts.addParameterListener (paramID, this);
-        updateValue (defaultValue);
+        ));
     }
 
 public:
@@ -129,7 +215,7 @@ public:
                               const float minValue,
                               const float maxValue,
                               const float defaultValue,
-                              const std::function<float (float)> callback = nullptr)
+                              const ValueMapping callback = nullptr)
         : PluginParameterSlider (parametersManager,
                                  paramName,
                                  labelText,
@@ -153,7 +239,7 @@ public:
                               const float minValue,
                               const float maxValue,
                               const float defaultValue,
-                              const std::function<float (float)> callback = nullptr)
+                              const ValueMapping callback = nullptr)
         : PluginParameterSlider (parametersManager,
                                  paramName,
                                  labelText,
@@ -174,25 +260,22 @@ public:
     PluginParameterToggle (PluginParametersManager& parametersManager,
                            const String& paramName,
                            const bool defaultState = false,
-                           const std::function<float (float)> callback = nullptr)
+                           const ValueMapping callback = nullptr)
         : PluginParameter (parametersManager, callback)
         , paramName (paramName)
         , defaultState (defaultState)
     {
         paramID = paramName.removeCharacters (" ").toLowerCase();
-        parametersManager.parameterTypes.add ("ToggleButton");
+        parametersManager.parameterIDs.add (paramID);
+        parametersManager.parameterTypes.add (PluginParametersManager::parameterTypeToggle);
 
-        const StringArray toggleStates = {"False", "True"};
         NormalisableRange<float> range (0.0f, 1.0f, 1.0f);
 
-        parametersManager.apvts.createAndAddParameter (std::make_unique<Parameter>
+        registerParameter (parametersManager.apvts.createAndAddParameter (std::make_unique<Parameter>
             (paramID, paramName, "", range, (float)defaultState,
-             [toggleStates](float value){ return toggleStates[(int)value]; },
-             [toggleStates](const String& text){ return toggleStates.indexOf (text); })
-        );
-
-        parametersManager.apvts.addParameterListener (paramID, this);
-        updateValue ((float)defaultState);
+             [](float value){ return String (value > 0.5f ? "True" : "False"); },
+             [](const String& text){ return text == "True" ? 1.0f : 0.0f; })
+        ));
     }
 
     const String& paramName;
@@ -204,34 +287,35 @@ public:
 class PluginParameterComboBox : public PluginParameter
 {
 public:
+    // The item list is referenced, not copied, so it has to outlive the parameter;
+    // a static list is shared by all instances of a plug-in.
     PluginParameterComboBox (PluginParametersManager& parametersManager,
                              const String& paramName,
-                             const StringArray items,
+                             const StringArray& items,
                              const int defaultChoice = 0,
-                             const std::function<float (const float)> callback = nullptr)
+                             const ValueMapping callback = nullptr)
         : PluginParameter (parametersManager, callback)
         , paramName (paramName)
         , items (items)
         , defaultChoice (defaultChoice)
     {
         paramID = paramName.removeCharacters (" ").toLowerCase();
-        parametersManager.parameterTypes.add ("ComboBox");
+        parametersManager.parameterIDs.add (paramID);
+        parametersManager.parameterTypes.add (PluginParametersManager::parameterTypeComboBox);
 
-        parametersManager.comboBoxItemLists.add (items);
+        parametersManager.comboBoxItemLists.add (&items);
         NormalisableRange<float> range (0.0f, (float)items.size() - 1.0f, 1.0f);
+        const StringArray* itemList = &items;
 
-        parametersManager.apvts.createAndAddParameter (std::make_unique<Parameter>
+        registerParameter (parametersManager.apvts.createAndAddParameter (std::make_unique<Parameter>
             (paramID, paramName, "", range, (float)defaultChoice,
-             [items](float value){ return items[(int)value]; },
-             [items](const String& text){ return items.indexOf (text); })
-        );
-
-        parametersManager.apvts.addParameterListener (paramID, this);
-        updateValue ((float)defaultChoice);
+             [itemList](float value){ return (*itemList)[(int)value]; },
+             [itemList](const String& text){ return (float)itemList->indexOf (text); })
+        ));
     }
 
     const String& paramName;
-    const StringArray items;
+    const StringArray& items;
     const int defaultChoice;
 };
 
@@ -2,10 +2,36 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "StateGuard.h"
 #include "PluginParameter.h"
 
 //==============================================================================
 
+const StringArray DistortionAudioProcessor::distortionTypeItemsUI = {
+    "Hard clipping",
+    "Soft clipping",
+    "Exponential",
+    "Full-wave rectifier",
+    "Half-wave rectifier",
+    "Araya&Suyama System",
+    "Doidic Symmetric",
+    "Doidic Assymmetric",
+    "Diode clipper"
+};
+
+const StringArray DistortionAudioProcessor::diodeSolverItemsUI = {
+    "Newton-Raphson",
+    "K-method table"
+};
+
+const StringArray DistortionAudioProcessor::stereoModeItemsUI = {
+    "Dual mono",
+    "Linked",
+    "Mid/Side"
+};
+
+//==============================================================================
+
 DistortionAudioProcessor::DistortionAudioProcessor():
 #ifndef JucePlugin_PreferredChannelConfigurations
     AudioProcessor (BusesProperties()
@@ -23,63 +49,171 @@ DistortionAudioProcessor::DistortionAudioProcessor():
                       [](float value){ return powf (10.0f, value * 0.05f); })
     , paramOutputGain (parameters, "Output gain", "dB", -60.0f, 24.0f, -24.0f,
                        [](float value){ return powf (10.0f, value * 0.05f); })
-    , paramTone (parameters, "Tone", "dB", -24.0f, 24.0f, 12.0f,
-                 [this](float value){ paramTone.setCurrentAndTargetValue (value); updateFilters(); return value; })
+    , paramTone (parameters, "Tone", "dB", -24.0f, 24.0f, 12.0f)
+    , paramGateThreshold (parameters, "Gate threshold", "dB", -96.0f, 0.0f, -96.0f)
+    , paramGateHysteresis (parameters, "Gate hysteresis", "dB", 0.0f, 24.0f, 6.0f)
+    , paramGateLookahead (parameters, "Gate lookahead")
+    , paramDiodeSolver (parameters, "Diode solver", diodeSolverItemsUI, DiodeClipper::solverNewtonRaphson)
+    , paramToneStack (parameters, "Tone stack")
+    , paramBass (parameters, "Bass", "", 0.0f, 10.0f, 5.0f, [](float value){ return value * 0.1f; })
+    , paramMiddle (parameters, "Middle", "", 0.0f, 10.0f, 5.0f, [](float value){ return value * 0.1f; })
+    , paramTreble (parameters, "Treble", "", 0.0f, 10.0f, 5.0f, [](float value){ return value * 0.1f; })
+    , paramStereoMode (parameters, "Stereo mode", stereoModeItemsUI, stereoModeLinked)
+    , paramSideDrive (parameters, "Side drive", "dB", -24.0f, 24.0f, 0.0f,
+                      [](float value){ return powf (10.0f, value * 0.05f); })
+    , paramBiasShift (parameters, "Bias shift", "%", 0.0f, 100.0f, 0.0f, [](float value){ return value * 0.01f; })
 {
     parameters.apvts.state = ValueTree (Identifier (getName().removeCharacters ("- ")));
-    mixer.setMixingRule (dsp::DryWetMixingRule::linear);
 
+    //======================================
+
+    clearPendingChanges();
+
+    for (auto& mapping : midiControllerMap)
+        mapping = -1;
+
+    if (presets->initialise (parameters)) {
+        presets->addFactoryPreset ("Default", {});
+        presets->addFactoryPreset ("Warm overdrive",
+            { { "distortiontype", distortionTypeSoftClipping }, { "inputgain", 6.0f }, { "outputgain", -6.0f }, { "tone", 6.0f } });
+        presets->addFactoryPreset ("Crunch",
+            { { "distortiontype", distortionTypeHardClipping }, { "inputgain", 18.0f }, { "outputgain", -12.0f }, { "tone", 0.0f } });
+        presets->addFactoryPreset ("Smooth lead",
+            { { "distortiontype", distortionTypeExponential }, { "inputgain", 24.0f }, { "outputgain", -9.0f }, { "tone", 9.0f } });
+        presets->addFactoryPreset ("Octave fuzz",
+            { { "distortiontype", distortionTypeFullWaveRectifier }, { "inputgain", 24.0f }, { "outputgain", -24.0f }, { "tone", -6.0f } });
+        presets->addFactoryPreset ("Tube asymmetry",
+            { { "distortiontype", distortionTypeDoidicAssymetric }, { "inputgain", -12.0f }, { "outputgain", 0.0f }, { "tone", 12.0f } });
+    }
+
+    presets->addListener (this);
+
+    // User presets, like all the DSP state, are only loaded once an instance is actually
+    // used. The bank is shared, so the folder is scanned once however many instances there are.
 }
 
 DistortionAudioProcessor::~DistortionAudioProcessor()
 {
+    presets->removeListener (this);
+    cancelPendingUpdate();
+}
+
+// The default operator new only honours the snapshot's alignment from C++17 on,
+// so the block is over-allocated and the original pointer kept just below the instance
+void* DistortionAudioProcessor::operator new (const size_t size)
+{
+    const size_t alignment = alignof (DistortionAudioProcessor);
+    void* const block = ::operator new (size + alignment + sizeof (void*));
+    const uintptr_t start = (uintptr_t)block + sizeof (void*);
+    void** const instance = (void**)((start + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    instance[-1] = block;
+    return instance;
+}
+
+void DistortionAudioProcessor::operator delete (void* const pointer) noexcept
+{
+    if (pointer != nullptr)
+        ::operator delete (((void**)pointer)[-1]);
 }
 
 //==============================================================================
 
 void DistortionAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
-    const double smoothTime = 1e-3;
-    paramDistortionType.reset (sampleRate, smoothTime);
-    paramInputGain.reset (sampleRate, smoothTime);
-    paramOutputGain.reset (sampleRate, smoothTime);
-    paramTone.reset (sampleRate, smoothTime);
-    //======================================
-    dsp::ProcessSpec spec;
-    spec.sampleRate = sampleRate;
-    spec.maximumBlockSize = samplesPerBlock;
-    spec.numChannels = getTotalNumInputChannels();
-    
-    inputGain.prepare(spec);
-    outputGain.prepare(spec);
-    
-    for (auto& waveshaper : waveShapers)
-    {
-        waveshaper.prepare(spec);
-    }
+    // Everything below only ever sees sub-blocks, whatever the host announces
+    ignoreUnused (samplesPerBlock);
+    preparedBlockSize = internalBlockSize;
+    const int maxBlockSize = preparedBlockSize;
+    const int numChannels = getTotalNumInputChannels();
+
+    pullParameters();
+    loadUserPresets();
+
     //======================================
-    oversampler.initProcessing(samplesPerBlock);
-    mixer.setMixingRule(dsp::DryWetMixingRule::linear);
-    mixer.prepare(spec);
-    
-    
+
+    const QualityProfile& profile = getTargetProfile();
+    qualityProfile = &profile;
+    oversamplerChannels = numChannels;
+    oversampler = std::make_unique<dsp::Oversampling<float>> ((size_t)jmax (1, numChannels),
+                                                              (size_t)profile.oversamplingOrder,
+                                                              profile.oversamplingFilter, true, true);
+
+    // The oversampler keeps its own buffers and is not part of the arena
+    oversampler->initProcessing ((size_t)maxBlockSize);
+
+    const int oversamplingFactor = (int)oversampler->getOversamplingFactor();
+    const double oversampledRate = sampleRate * oversamplingFactor;
+    const int maxOversampledBlockSize = maxBlockSize * oversamplingFactor;
+
     //======================================
 
-    filters.clear();
-    for (int i = 0; i < getTotalNumInputChannels(); ++i) {
-        Filter* filter;
-        filters.add (filter = new Filter());
-    }
+    arena.prepare (NoiseGate::getRequiredBytes (sampleRate, numChannels, maxBlockSize)
+                   + DiodeClipper::getRequiredBytes (numChannels, profile.diodeClipperTableSize)
+                   + ToneStack::getRequiredBytes (numChannels)
+                   + BiasShift::getRequiredBytes (numChannels, maxBlockSize)
+                   + DspArena::getRequiredBytes<float> ((size_t)numChannels)
+                   + DspArena::getRequiredBytes<float> ((size_t)maxBlockSize)
+                   + DspArena::getRequiredBytes<float*> ((size_t)numChannels)
+                   + (size_t)numChannels * DspArena::getRequiredBytes<float> ((size_t)maxOversampledBlockSize));
+
+    noiseGate.prepare (arena, sampleRate, numChannels, maxBlockSize);
+    noiseGate.setParameters (snapshot.gateThreshold, snapshot.gateHysteresis, snapshot.gateLookahead,
+                             snapshot.stereoMode != stereoModeDualMono);
+
+    // The clipper sits inside the oversampled section
+    diodeClipper.prepare (arena, oversampledRate, numChannels, profile.diodeClipperIterations,
+                          profile.diodeClipperTableSize, getShaperDomain (distortionTypeDiodeClipper));
+
+    biasShift.prepare (arena, sampleRate, numChannels, maxBlockSize, snapshot.biasShift);
+    biasShift.setLinked (snapshot.stereoMode == stereoModeLinked);
+
+    toneStack.prepare (arena, sampleRate, numChannels);
+    toneStack.setKnobs (snapshot.bass, snapshot.middle, snapshot.treble);
+    toneStackMix = snapshot.toneStack ? 1.0f : 0.0f;
+    toneStackStep = (float)(1.0 / (switchTime * sampleRate));
+
+    numFilterStates = numChannels;
+    filterStates = arena.allocate<float> ((size_t)numChannels);
+    currentTone = snapshot.tone;
     updateFilters();
-    
-    //======================================
 
-    //We need to limit the input when using ArayaAndSuyama
-    //otherwise, f(x) will tend to infinite
-    //if((int)paramDistortionType.getTargetValue() == 5  && paramInputGain.getNextValue() > 7.6f)
-    
+    gainRamp = arena.allocate<float> ((size_t)maxBlockSize);
+    currentStereoMode = snapshot.stereoMode;
+
+    numCrossfadeChannels = numChannels;
+    crossfadeBufferSize = maxOversampledBlockSize;
+    crossfadeChannels = arena.allocate<float*> ((size_t)numChannels);
+
+    for (int channel = 0; channel < numChannels; ++channel)
+        crossfadeChannels[channel] = arena.allocate<float> ((size_t)maxOversampledBlockSize);
+
+    shaperCrossfadeLength = jmax (1, roundToInt (switchTime * oversampledRate));
+    shaperCrossfadeRemaining = 0;
+    currentDistortionType = snapshot.distortionType;
+
+    recoveryLength = jmax (1, roundToInt (recoveryTime * sampleRate));
+    recoveryRemaining = 0;
+    stereoFadeLength = jmax (1, roundToInt (switchTime * sampleRate));
+    stereoFadeRemaining = 0;
+
+    setLatencySamples (getLatency());
+
     //======================================
-    
+
+    inputGain.reset (sampleRate, switchTime);
+    outputGain.reset (sampleRate, switchTime);
+    sideGain.reset (sampleRate, switchTime);
+    inputGain.setCurrentAndTargetValue (snapshot.inputGain);
+    outputGain.setCurrentAndTargetValue (snapshot.outputGain);
+    sideGain.setCurrentAndTargetValue (snapshot.sideGain);
+
+    for (auto* value : { &smoothedTone, &smoothedBass, &smoothedMiddle, &smoothedTreble })
+        value->reset (sampleRate, switchTime);
+
+    smoothedTone.setCurrentAndTargetValue (snapshot.tone);
+    smoothedBass.setCurrentAndTargetValue (snapshot.bass);
+    smoothedMiddle.setCurrentAndTargetValue (snapshot.middle);
+    smoothedTreble.setCurrentAndTargetValue (snapshot.treble);
 }
 
 void DistortionAudioProcessor::releaseResources()
@@ -93,38 +227,775 @@ void DistortionAudioProcessor::processBlock (AudioSampleBuffer& buffer, MidiBuff
     const int numInputChannels = getTotalNumInputChannels();
     const int numOutputChannels = getTotalNumOutputChannels();
     const int numSamples = buffer.getNumSamples();
-    
+
     //======================================
+
+    const int program = pendingProgram.exchange (-1);
+
+    if (program >= 0)
+        applyProgram (program);
+
+    // Split the block at every MIDI event, so that controller moves
+    // take effect at their exact sample position
+    int startSample = 0;
+
+    for (const auto metadata : midiMessages) {
+        const int eventPosition = jlimit (0, numSamples, metadata.samplePosition);
+
+        if (eventPosition > startSample) {
+            processRange (buffer, startSample, eventPosition - startSample);
+            startSample = eventPosition;
+        }
+
+        handleMidiEvent (metadata.getMessage());
+    }
+
+    if (startSample < numSamples)
+        processRange (buffer, startSample, numSamples - startSample);
+
+    //======================================
+    for (int channel = numInputChannels; channel < numOutputChannels; ++channel)
+        buffer.clear (channel, 0, numSamples);
+
+   #if JUCE_DEBUG
+    checkOutput (buffer);
+   #endif
+}
+
+#if JUCE_DEBUG
+// Debug builds stop on the first non-finite or denormal output sample, with the
+// settings that produced it, so that changes to the shapers, the filters or the
+// gain staging can't slip a NaN or a denormal burst past a listening test.
+void DistortionAudioProcessor::checkOutput (const AudioSampleBuffer& buffer)
+{
+    for (int channel = 0; channel < buffer.getNumChannels(); ++channel) {
+        const float* samples = buffer.getReadPointer (channel);
+
+        for (int i = 0; i < buffer.getNumSamples(); ++i) {
+            const float sample = samples[i];
+            const bool isFinite = std::isfinite (sample);
+
+            if (isFinite && (sample == 0.0f || std::isnormal (sample)))
+                continue;
+
+            DBG ((isFinite ? "Denormal" : "Non-finite") << " output " << sample
+                 << " at channel " << channel << ", sample " << i
+                 << " (distortion type " << snapshot.distortionType
+                 << ", input gain " << snapshot.inputGain << ", tone " << snapshot.tone << ")");
+            jassertfalse;
+            return;
+        }
+    }
+}
+#endif
+
+void DistortionAudioProcessor::processRange (AudioSampleBuffer& buffer, int startSample, int numSamples)
+{
+    while (numSamples > 0) {
+        const int numSubBlockSamples = jmin (numSamples, preparedBlockSize);
+        processSubBlock (buffer, startSample, numSubBlockSamples);
+
+        startSample += numSubBlockSamples;
+        numSamples -= numSubBlockSamples;
+    }
+}
+
+void DistortionAudioProcessor::processSubBlock (AudioSampleBuffer& buffer, const int startSample, const int numSamples)
+{
+    dsp::AudioBlock<float> audioBlock = dsp::AudioBlock<float> (buffer).getSubBlock ((size_t)startSample, (size_t)numSamples);
+
+    pullParameters();
+
+    //======================================
+
+    const int gateLatency = noiseGate.getLatencySamples();
+    noiseGate.setParameters (snapshot.gateThreshold, snapshot.gateHysteresis, snapshot.gateLookahead,
+                             snapshot.stereoMode != stereoModeDualMono);
+
+    if (noiseGate.getLatencySamples() != gateLatency) {
+        latencyChanged = true;
+        triggerAsyncUpdate();
+    }
+
+    // Nothing gets past a closed gate, so the nonlinear stages have nothing to do
+    dsp::AudioBlock<float> gateBlock = audioBlock.getSubsetChannelBlock (0, (size_t)getTotalNumInputChannels());
+    const bool metering = meteringEnabled.load (std::memory_order_relaxed);
+    MeterFrame meterFrame {};
+    meterFrame.numSamples = numSamples * (int)gateBlock.getNumChannels();
+
+    if (noiseGate.process (gateBlock)) {
+        applyGuard (gateBlock, 0.0f);
+
+        if (metering)
+            meterFifo.push (meterFrame);
+
+        return;
+    }
+
+    //======================================
+
+    // Channels change meaning between L/R and M/S, so the channel states have to start
+    // over; the old mode runs on while the output fades out, and the reset waits for silence
+    if (snapshot.stereoMode != currentStereoMode) {
+        if ((snapshot.stereoMode == stereoModeMidSide) == (currentStereoMode == stereoModeMidSide))
+            currentStereoMode = snapshot.stereoMode;
+        else if (stereoFadeRemaining == 0)
+            stereoFadeRemaining = stereoFadeLength;
+    }
+
+    applyInputStage (gateBlock);
+
+    // The shelf follows the smoothed tone once per sub-block, in steps too small to hear
+    smoothedTone.setTargetValue (snapshot.tone);
+    const float tone = smoothedTone.skip (numSamples);
+
+    if (tone != currentTone) {
+        currentTone = tone;
+        updateFilters();
+    }
+
+    dsp::ProcessContextReplacing<float> filterBlock (audioBlock);
     
-    dsp::AudioBlock<float> audioBlock (buffer);
-    
-    inputGain.setGainLinear(paramInputGain.getNextValue());
-    dsp::ProcessContextReplacing<float> inputGainBlock (audioBlock);
-        
-    inputGain.process(inputGainBlock);
-    
-    dsp::ProcessContextReplacing<float> filterBlock (inputGainBlock);
-    
-    for (int i = 0; i < filters.size(); i++) {
-       const auto& filter = filters.getUnchecked(i);
-        
+    for (int i = 0; i < numFilterStates; i++) {
         auto& block = filterBlock.getOutputBlock();
-        float* samples= block.getChannelPointer(i);
-        const int numSamples = (int) block.getNumSamples();
-        filter->processSamples(samples, numSamples);
+        float* samples= block.getChannelPointer((size_t)i);
+        filter.processSamples(samples, numSamples, filterStates[i]);
+    }
+
+    dsp::AudioBlock<float> shaperBlock = filterBlock.getOutputBlock().getSubsetChannelBlock (0, (size_t)oversamplerChannels);
+
+    if (metering) {
+        float unusedMin, unusedMax;
+        measureLevels (shaperBlock, meterFrame.drivePeak, meterFrame.driveSquares, unusedMin, unusedMax);
     }
 
-    auto& waveshaper = waveShapers[(int) paramDistortionType.getTargetValue()];
+    // The bias moves slowly, so it can be added before upsampling
+    biasShift.setAmount (snapshot.biasShift);
+    biasShift.setLinked (snapshot.stereoMode == stereoModeLinked);
+    const bool isBiasShifting = biasShift.applyBias (shaperBlock);
+
+    dsp::AudioBlock<float> oversampledBlock = oversampler->processSamplesUp (shaperBlock);
+    processShaper (oversampledBlock);
+    oversampler->processSamplesDown (shaperBlock);
+
+    if (isBiasShifting)
+        biasShift.applyCoupling (shaperBlock);
+
     dsp::ProcessContextReplacing<float> distortionBlock (filterBlock);
-    waveshaper.process(distortionBlock);
-    
-    outputGain.setGainLinear(paramOutputGain.getNextValue());
-    dsp::ProcessContextReplacing<float> outputGainBlock (distortionBlock);
-    outputGain.process(outputGainBlock);
+
+    // Post-distortion tone stack, as in an amp; the coefficients are only interpolated here,
+    // so the knobs can follow their smoothed values every sub-block
+    smoothedBass.setTargetValue (snapshot.bass);
+    smoothedMiddle.setTargetValue (snapshot.middle);
+    smoothedTreble.setTargetValue (snapshot.treble);
+    const float bass = smoothedBass.skip (numSamples);
+    const float middle = smoothedMiddle.skip (numSamples);
+    const float treble = smoothedTreble.skip (numSamples);
+
+    // Switched on from fully off, it starts from silence
+    if (snapshot.toneStack && toneStackMix == 0.0f)
+        toneStack.reset();
+
+    if (snapshot.toneStack || toneStackMix > 0.0f) {
+        toneStack.setKnobs (bass, middle, treble);
+
+        if (snapshot.toneStack && toneStackMix == 1.0f)
+            toneStack.process (distortionBlock.getOutputBlock());
+        else
+            processToneStackFade (distortionBlock.getOutputBlock(), snapshot.toneStack ? 1.0f : 0.0f);
+    }
     
-    //======================================
-    for (int channel = numInputChannels; channel < numOutputChannels; ++channel)
-        buffer.clear (channel, 0, numSamples);
+    applyOutputStage (gateBlock);
+    const bool isStereoSwitchDue = fadeOutForStereoSwitch (gateBlock);
+
+    // The sum of squares is not finite as soon as one sample isn't, and the
+    // meters need it anyway
+    float outputSquares = 0.0f;
+
+    if (metering) {
+        measureLevels (gateBlock, meterFrame.outputPeak, meterFrame.outputSquares,
+                       meterFrame.outputMin, meterFrame.outputMax);
+        outputSquares = meterFrame.outputSquares;
+    }
+    else {
+        for (size_t channel = 0; channel < gateBlock.getNumChannels(); ++channel)
+            outputSquares += getSumOfSquares (gateBlock.getChannelPointer (channel), numSamples);
+    }
+
+    if (! applyGuard (gateBlock, outputSquares))
+        meterFrame = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, meterFrame.numSamples };
+
+    // Silent now, so nothing of the reset is heard; the guard's recovery fades the new mode in
+    if (isStereoSwitchDue) {
+        resetDspState();
+        currentStereoMode = snapshot.stereoMode;
+        recoveryRemaining = recoveryLength;
+    }
+
+    if (metering)
+        meterFifo.push (meterFrame);
+}
+
+// Switching the tone stack on or off crossfades between its output and its input,
+// which the shaper crossfade's buffers hold meanwhile; they are free at this point
+void DistortionAudioProcessor::processToneStackFade (dsp::AudioBlock<float>& block, const float targetMix) noexcept
+{
+    const int numChannels = jmin ((int)block.getNumChannels(), numCrossfadeChannels);
+    const int numSamples = (int)block.getNumSamples();
+    float mix = toneStackMix;
+
+    for (int channel = 0; channel < numChannels; ++channel)
+        FloatVectorOperations::copy (crossfadeChannels[channel], block.getChannelPointer ((size_t)channel), numSamples);
+
+    toneStack.process (block);
+
+    for (int channel = 0; channel < numChannels; ++channel) {
+        float* samples = block.getChannelPointer ((size_t)channel);
+        const float* dry = crossfadeChannels[channel];
+        mix = toneStackMix;
+
+        for (int i = 0; i < numSamples; ++i) {
+            mix = targetMix > mix ? jmin (targetMix, mix + toneStackStep) : jmax (targetMix, mix - toneStackStep);
+            samples[i] = dry[i] + mix * (samples[i] - dry[i]);
+        }
+    }
+
+    toneStackMix = mix;
+}
+
+//==============================================================================
+
+// Runs at the end of every sub-block, so that a NaN or an Inf produced anywhere
+// (outside a shaper's domain, or from the host's input) costs one silent block
+// instead of the instance. The recursive states are checked and flushed of
+// denormals here too; the oversampler's filters can't be inspected, but they
+// feed the output, so they are caught there. Returns false if the block was silenced.
+bool DistortionAudioProcessor::applyGuard (dsp::AudioBlock<float>& block, const float outputSquares) noexcept
+{
+    const bool isOutputFinite = std::isfinite (outputSquares);
+    bool isStateFinite = StateGuard::sanitise (filterStates, numFilterStates);
+    isStateFinite = noiseGate.sanitiseState() && isStateFinite;
+    isStateFinite = diodeClipper.sanitiseState() && isStateFinite;
+    isStateFinite = biasShift.sanitiseState() && isStateFinite;
+    isStateFinite = toneStack.sanitiseState() && isStateFinite;
+
+    if (isOutputFinite && isStateFinite) {
+        const int numSamples = (int)block.getNumSamples();
+        const int numFadeSamples = jmin (recoveryRemaining, numSamples);
+
+        for (size_t channel = 0; channel < block.getNumChannels() && numFadeSamples > 0; ++channel) {
+            float* samples = block.getChannelPointer (channel);
+
+            for (int i = 0; i < numFadeSamples; ++i)
+                samples[i] *= 1.0f - (float)(recoveryRemaining - i) / (float)recoveryLength;
+        }
+
+        recoveryRemaining -= numFadeSamples;
+        return true;
+    }
+
+    // A handled case, in debug builds too: the trip is only counted, for getGuardStatistics()
+    (isOutputFinite ? stateTrips : outputTrips).fetch_add (1, std::memory_order_relaxed);
+
+    block.clear();
+    resetDspState();
+    noiseGate.reset();
+    recoveryRemaining = recoveryLength;
+
+    return false;
+}
+
+void DistortionAudioProcessor::resetDspState() noexcept
+{
+    FloatVectorOperations::clear (filterStates, numFilterStates);
+    oversampler->reset();
+    diodeClipper.reset();
+    biasShift.reset();
+    toneStack.reset();
+}
+
+//==============================================================================
+
+// In mid/side mode the encoding is folded into the input gain loop and the
+// decoding into the output gain loop, so M/S costs no extra pass over the buffer.
+// Everything in between processes mid and side as channels 0 and 1.
+
+bool DistortionAudioProcessor::isMidSide (const dsp::AudioBlock<float>& block) const noexcept
+{
+    return currentStereoMode == stereoModeMidSide && block.getNumChannels() == 2;
+}
+
+// Ramps the output down over the sub-blocks ahead of a switch between L/R and M/S.
+// Returns true with the sub-block that reaches silence.
+bool DistortionAudioProcessor::fadeOutForStereoSwitch (dsp::AudioBlock<float>& block) noexcept
+{
+    if (stereoFadeRemaining == 0)
+        return false;
+
+    const int numSamples = (int)block.getNumSamples();
+    const int numFadeSamples = jmin (stereoFadeRemaining, numSamples);
+
+    for (size_t channel = 0; channel < block.getNumChannels(); ++channel) {
+        float* samples = block.getChannelPointer (channel);
+
+        for (int i = 0; i < numFadeSamples; ++i)
+            samples[i] *= (float)(stereoFadeRemaining - i - 1) / (float)stereoFadeLength;
+
+        FloatVectorOperations::clear (samples + numFadeSamples, numSamples - numFadeSamples);
+    }
+
+    stereoFadeRemaining -= numFadeSamples;
+    return stereoFadeRemaining == 0;
+}
+
+void DistortionAudioProcessor::applyInputStage (dsp::AudioBlock<float>& block) noexcept
+{
+    const int numSamples = (int)block.getNumSamples();
+    inputGain.setTargetValue (snapshot.inputGain);
+    sideGain.setTargetValue (snapshot.sideGain);
+
+    if (! isMidSide (block)) {
+        sideGain.skip (numSamples);
+        applyGain (block, inputGain);
+        return;
+    }
+
+    float* left = block.getChannelPointer (0);
+    float* right = block.getChannelPointer (1);
+
+    for (int i = 0; i < numSamples; ++i) {
+        const float gain = 0.5f * inputGain.getNextValue();
+        const float side = gain * sideGain.getNextValue();
+        const float l = left[i];
+        const float r = right[i];
+
+        left[i] = gain * (l + r);
+        right[i] = side * (l - r);
+    }
+}
+
+void DistortionAudioProcessor::applyOutputStage (dsp::AudioBlock<float>& block) noexcept
+{
+    const int numSamples = (int)block.getNumSamples();
+    outputGain.setTargetValue (snapshot.outputGain);
+
+    if (! isMidSide (block)) {
+        applyGain (block, outputGain);
+        return;
+    }
+
+    float* mid = block.getChannelPointer (0);
+    float* side = block.getChannelPointer (1);
+
+    for (int i = 0; i < numSamples; ++i) {
+        const float gain = outputGain.getNextValue();
+        const float m = mid[i];
+        const float s = side[i];
+
+        mid[i] = gain * (m + s);
+        side[i] = gain * (m - s);
+    }
+}
+
+void DistortionAudioProcessor::applyGain (dsp::AudioBlock<float>& block, LinearSmoothedValue<float>& gain) noexcept
+{
+    const int numSamples = (int)block.getNumSamples();
+
+    if (! gain.isSmoothing()) {
+        const float value = gain.getCurrentValue();
+
+        for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+            FloatVectorOperations::multiply (block.getChannelPointer (channel), value, numSamples);
+
+        return;
+    }
+
+    for (int i = 0; i < numSamples; ++i)
+        gainRamp[i] = gain.getNextValue();
+
+    for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+        FloatVectorOperations::multiply (block.getChannelPointer (channel), gainRamp, numSamples);
+}
+
+//==============================================================================
+
+void DistortionAudioProcessor::measureLevels (const dsp::AudioBlock<float>& block, float& peak, float& squares,
+                                              float& minimum, float& maximum) noexcept
+{
+    const int numSamples = (int)block.getNumSamples();
+    minimum = maximum = squares = 0.0f;
+
+    for (size_t channel = 0; channel < block.getNumChannels(); ++channel) {
+        const float* samples = block.getChannelPointer (channel);
+        const Range<float> range = FloatVectorOperations::findMinAndMax (samples, numSamples);
+        minimum = jmin (minimum, range.getStart());
+        maximum = jmax (maximum, range.getEnd());
+
+        squares += getSumOfSquares (samples, numSamples);
+    }
+
+    peak = jmax (-minimum, maximum);
+}
+
+float DistortionAudioProcessor::getSumOfSquares (const float* samples, const int numSamples) noexcept
+{
+    // Four partial sums, so the compiler can keep them in one vector register
+    float sum[4] = {};
+    int i = 0;
+
+    for (; i + 4 <= numSamples; i += 4)
+        for (int j = 0; j < 4; ++j)
+            sum[j] += samples[i + j] * samples[i + j];
+
+    for (; i < numSamples; ++i)
+        sum[0] += samples[i] * samples[i];
+
+    return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+//==============================================================================
+
+void DistortionAudioProcessor::handleMidiEvent (const MidiMessage& message)
+{
+    if (message.isProgramChange()) {
+        applyProgram (message.getProgramChangeNumber());
+        return;
+    }
+
+    if (! message.isController())
+        return;
+
+    const int controller = message.getControllerNumber();
+    const int learnParameter = midiLearnParameter.exchange (-1);
+
+    if (learnParameter >= 0) {
+        for (auto& mapping : midiControllerMap)
+            if (mapping == learnParameter)
+                mapping = -1;
+
+        midiControllerMap[(size_t)controller] = learnParameter;
+    }
+
+    const int index = midiControllerMap[(size_t)controller];
+
+    if (isPositiveAndBelow (index, parameters.parameterList.size())) {
+        const RangedAudioParameter* parameter = parameters.parameterList.getUnchecked (index)->parameter;
+        setParameterFromAudioThread (index, parameter->convertFrom0to1 (message.getControllerValue() / 127.0f));
+    }
+}
+
+void DistortionAudioProcessor::setInternalBlockSize (const int numSamples)
+{
+    internalBlockSize = jlimit ((int)minInternalBlockSize, (int)maxInternalBlockSize, numSamples);
+}
+
+//==============================================================================
+
+void DistortionAudioProcessor::startMidiLearn (const int parameterIndex)
+{
+    midiLearnParameter = parameterIndex;
+}
+
+void DistortionAudioProcessor::clearMidiMapping (const int parameterIndex)
+{
+    for (auto& mapping : midiControllerMap)
+        if (mapping == parameterIndex)
+            mapping = -1;
+}
+
+int DistortionAudioProcessor::getMidiController (const int parameterIndex) const
+{
+    for (int controller = 0; controller < (int)midiControllerMap.size(); ++controller)
+        if (midiControllerMap[(size_t)controller] == parameterIndex)
+            return controller;
+
+    return -1;
+}
+
+//==============================================================================
+
+void DistortionAudioProcessor::processShaper (dsp::AudioBlock<float>& block)
+{
+    const int distortionType = snapshot.distortionType;
+
+    // Switching curves mid-stream is discontinuous, so fade from the old curve to the new one
+    if (distortionType != currentDistortionType) {
+        previousDistortionType = currentDistortionType;
+        currentDistortionType = distortionType;
+        shaperCrossfadeRemaining = shaperCrossfadeLength;
+
+        if (distortionType == distortionTypeDiodeClipper)
+            diodeClipper.reset();
+    }
+
+    const int numSamples = (int) block.getNumSamples();
+    const int numFadeSamples = jmin (shaperCrossfadeRemaining, numSamples, crossfadeBufferSize);
+    const size_t numFadeChannels = jmin (block.getNumChannels(), (size_t)numCrossfadeChannels);
+
+    dsp::AudioBlock<float> fadeBlock (crossfadeChannels, numFadeChannels, (size_t)numFadeSamples);
+
+    const bool isCrossfading = numFadeSamples > 0 && isPositiveAndBelow (previousDistortionType, distortionTypeItemsUI.size());
+
+    if (isCrossfading) {
+        fadeBlock.copyFrom (block.getSubsetChannelBlock (0, numFadeChannels).getSubBlock (0, (size_t)numFadeSamples));
+        applyShaper (previousDistortionType, fadeBlock);
+    }
+
+    applyShaper (currentDistortionType, block);
+
+    if (isCrossfading) {
+        for (size_t channel = 0; channel < numFadeChannels; ++channel) {
+            float* samples = block.getChannelPointer (channel);
+            const float* oldSamples = fadeBlock.getChannelPointer (channel);
+
+            for (int i = 0; i < numFadeSamples; ++i) {
+                const float newGain = 1.0f - (float)(shaperCrossfadeRemaining - i) / (float)shaperCrossfadeLength;
+                samples[i] = oldSamples[i] + newGain * (samples[i] - oldSamples[i]);
+            }
+        }
+    }
+
+    shaperCrossfadeRemaining -= numFadeSamples;
+}
+
+//==============================================================================
+
+static inline float mapToDomain (const float in, const float domain) noexcept
+{
+    return in == in ? jlimit (-domain, domain, in) : 0.0f;
+}
+
+template <typename Function>
+static void shapeBlock (dsp::AudioBlock<float>& block, const float domain, Function&& function) noexcept
+{
+    const size_t numSamples = block.getNumSamples();
+
+    for (size_t channel = 0; channel < block.getNumChannels(); ++channel) {
+        float* samples = block.getChannelPointer (channel);
+
+        for (size_t i = 0; i < numSamples; ++i)
+            samples[i] = function (mapToDomain (samples[i], domain));
+    }
+}
+
+void DistortionAudioProcessor::applyShaper (const int distortionType, dsp::AudioBlock<float>& block)
+{
+    const float domain = getShaperDomain (distortionType);
+
+    switch (distortionType) {
+        case distortionTypeHardClipping:        shapeBlock (block, domain, [](float in){ return hardClipping (in); }); break;
+        case distortionTypeSoftClipping:        shapeBlock (block, domain, [](float in){ return softClipping (in); }); break;
+        case distortionTypeExponential:         shapeBlock (block, domain, [](float in){ return exponential (in); }); break;
+        case distortionTypeFullWaveRectifier:   shapeBlock (block, domain, [](float in){ return fullWaveRectifier (in); }); break;
+        case distortionTypeHalfWaveRectifier:   shapeBlock (block, domain, [](float in){ return halfWaveRectifier (in); }); break;
+        case distortionTypeArayaSuyama:         shapeBlock (block, domain, [](float in){ return ArayaAndSuyama (in); }); break;
+        case distortionTypeDoidicSymmetric:     shapeBlock (block, domain, [](float in){ return doidicSymmetric (in); }); break;
+        case distortionTypeDoidicAssymetric:    shapeBlock (block, domain, [](float in){ return doidicAssymetric (in); }); break;
+        case distortionTypeDiodeClipper:        diodeClipper.process (block, (DiodeClipper::Solver)snapshot.diodeSolver, domain); break;
+        default: break;
+    }
+}
+
+float DistortionAudioProcessor::getTransferCurve (const int distortionType, const float in)
+{
+    const float x = mapToDomain (in, getShaperDomain (distortionType));
+
+    switch (distortionType) {
+        case distortionTypeHardClipping:        return hardClipping (x);
+        case distortionTypeSoftClipping:        return softClipping (x);
+        case distortionTypeExponential:         return exponential (x);
+        case distortionTypeFullWaveRectifier:   return fullWaveRectifier (x);
+        case distortionTypeHalfWaveRectifier:   return halfWaveRectifier (x);
+        case distortionTypeArayaSuyama:         return ArayaAndSuyama (x);
+        case distortionTypeDoidicSymmetric:     return doidicSymmetric (x);
+        case distortionTypeDoidicAssymetric:    return doidicAssymetric (x);
+        case distortionTypeDiodeClipper:        return (float)DiodeClipper::getStaticVoltage (x);
+        default:                                return x;
+    }
+}
+
+float DistortionAudioProcessor::getShaperDomain (const int distortionType)
+{
+    switch (distortionType) {
+        // x (1 - x^2 / 3) peaks at |x| = 1 and diverges beyond it
+        case distortionTypeArayaSuyama:         return 1.0f;
+        // 2|x| - x^2 peaks at |x| = 1 and folds back beyond it
+        case distortionTypeDoidicSymmetric:     return 1.0f;
+        // The piecewise curve is only defined on [-1, 1]
+        case distortionTypeDoidicAssymetric:    return 1.0f;
+        // Input in volts; the diodes have long clamped the output at this level
+        case distortionTypeDiodeClipper:        return 16.0f;
+        // The other curves are defined everywhere; just keep them finite
+        default:                                return 1.0e3f;
+    }
+}
+
+//==============================================================================
+
+void DistortionAudioProcessor::applyProgram (const int index)
+{
+    if (! isPositiveAndBelow (index, presets->getNumPresets()))
+        return;
+
+    const PresetBank::Snapshot& preset = presets->getSnapshot (index);
+
+    for (int i = 0; i < parameters.parameterList.size(); ++i)
+        setParameterFromAudioThread (i, preset.values[i]);
+
+    currentProgram = index;
+}
+
+void DistortionAudioProcessor::setParameterFromAudioThread (const int index, const float value)
+{
+    pendingHostValues[(size_t)index] = value;
+    triggerAsyncUpdate();
+}
+
+void DistortionAudioProcessor::clearPendingChanges() noexcept
+{
+    pendingProgram = -1;
+
+    for (auto& value : pendingHostValues)
+        value = std::numeric_limits<float>::quiet_NaN();
+}
+
+// Called from the preset loader thread
+void DistortionAudioProcessor::presetsLoaded()
+{
+    presetListChanged = true;
+    triggerAsyncUpdate();
+}
+
+void DistortionAudioProcessor::handleAsyncUpdate()
+{
+    // The APVTS value is updated before the pending one is dropped, so the audio thread never
+    // falls back to the old value in between. If the audio thread has queued a newer value
+    // meanwhile, it stays pending for the update that one triggered.
+    for (int i = 0; i < parameters.parameterIDs.size(); ++i) {
+        float value = pendingHostValues[(size_t)i];
+
+        if (std::isnan (value))
+            continue;
+
+        parameters.setParameterValue (parameters.parameterIDs[i], value);
+        pendingHostValues[(size_t)i].compare_exchange_strong (value, std::numeric_limits<float>::quiet_NaN());
+    }
+
+    if (presetListChanged.exchange (false))
+        updateHostDisplay();
+
+    if (latencyChanged.exchange (false))
+        setLatencySamples (getLatency());
+
+    if (qualityChanged.exchange (false))
+        switchQualityProfile();
+}
+
+//==============================================================================
+
+const DistortionAudioProcessor::QualityProfile DistortionAudioProcessor::realtimeProfile
+    { 1, dsp::Oversampling<float>::filterHalfBandPolyphaseIIR, 4, 4096 };
+
+const DistortionAudioProcessor::QualityProfile DistortionAudioProcessor::renderProfile
+    { 3, dsp::Oversampling<float>::filterHalfBandFIREquiripple, 16, 65536 };
+
+void DistortionAudioProcessor::setNonRealtime (const bool isNonRealtime) noexcept
+{
+    AudioProcessor::setNonRealtime (isNonRealtime);
+
+    ignoreUnused (isNonRealtime);
+
+    // Some hosts switch modes without calling prepareToPlay again, so the profile is
+    // switched here, before the host starts rendering. Hosts that switch from another
+    // thread get it done on the message thread; the audio thread never rebuilds anything.
+    if (oversampler == nullptr || &getTargetProfile() == qualityProfile.load())
+        return;
+
+    if (MessageManager::existsAndIsCurrentThread()) {
+        switchQualityProfile();
+    }
+    else {
+        qualityChanged = true;
+        triggerAsyncUpdate();
+    }
+}
+
+// Re-prepares with the profile of the current processing mode, unless the host has
+// prepared since. Message thread only, so that the latency is reported from there too.
+// Live, processing is suspended meanwhile and the host wrapper outputs silence; offline,
+// a render already running waits on the callback lock instead, so nothing of it is lost.
+void DistortionAudioProcessor::switchQualityProfile()
+{
+    if (getSampleRate() <= 0.0 || oversampler == nullptr || &getTargetProfile() == qualityProfile.load())
+        return;
+
+    if (isNonRealtime()) {
+        const ScopedLock sl (getCallbackLock());
+        prepareToPlay (getSampleRate(), getBlockSize());
+    }
+    else {
+        suspendProcessing (true);
+        prepareToPlay (getSampleRate(), getBlockSize());
+        suspendProcessing (false);
+    }
+}
+
+const DistortionAudioProcessor::QualityProfile& DistortionAudioProcessor::getTargetProfile() const noexcept
+{
+    return hasProfileOverride ? profileOverride
+         : isNonRealtime()    ? renderProfile
+                              : realtimeProfile;
+}
+
+void DistortionAudioProcessor::loadUserPresets()
+{
+    presets->loadUserPresets (File::getSpecialLocation (File::userApplicationDataDirectory)
+                                  .getChildFile (JucePlugin_Manufacturer)
+                                  .getChildFile (JucePlugin_Name)
+                                  .getChildFile ("Presets"));
+}
+
+void DistortionAudioProcessor::setQualityProfileOverride (const QualityProfile* profile)
+{
+    hasProfileOverride = profile != nullptr;
+
+    if (profile != nullptr)
+        profileOverride = *profile;
+}
+
+int DistortionAudioProcessor::getLatency() const noexcept
+{
+    const float oversamplerLatency = oversampler != nullptr ? oversampler->getLatencyInSamples() : 0.0f;
+    return roundToInt (oversamplerLatency) + noiseGate.getLatencySamples();
+}
+
+//==============================================================================
+
+float DistortionAudioProcessor::readParameter (const PluginParameter& parameter) const noexcept
+{
+    const size_t index = (size_t)parameter.index;
+    const float pendingValue = pendingHostValues[index];
+    const float value = std::isnan (pendingValue) ? parameter.rawValue->load() : pendingValue;
+    return parameter.map (value);
+}
+
+void DistortionAudioProcessor::pullParameters() noexcept
+{
+    snapshot.distortionType = jlimit (0, distortionTypeItemsUI.size() - 1, (int)readParameter (paramDistortionType));
+    snapshot.inputGain = readParameter (paramInputGain);
+    snapshot.outputGain = readParameter (paramOutputGain);
+    snapshot.tone = readParameter (paramTone);
+    snapshot.gateThreshold = readParameter (paramGateThreshold);
+    snapshot.gateHysteresis = readParameter (paramGateHysteresis);
+    snapshot.gateLookahead = readParameter (paramGateLookahead) > 0.5f;
+    snapshot.diodeSolver = jlimit (0, diodeSolverItemsUI.size() - 1, (int)readParameter (paramDiodeSolver));
+    snapshot.toneStack = readParameter (paramToneStack) > 0.5f;
+    snapshot.bass = readParameter (paramBass);
+    snapshot.middle = readParameter (paramMiddle);
+    snapshot.treble = readParameter (paramTreble);
+    snapshot.stereoMode = jlimit (0, stereoModeItemsUI.size() - 1, (int)readParameter (paramStereoMode));
+    snapshot.sideGain = readParameter (paramSideDrive);
+    snapshot.biasShift = readParameter (paramBiasShift);
 }
 
 //==============================================================================
@@ -132,10 +1003,33 @@ void DistortionAudioProcessor::processBlock (AudioSampleBuffer& buffer, MidiBuff
 void DistortionAudioProcessor::updateFilters()
 {
     double discreteFrequency = M_PI * 0.01;
-    double gain = pow (10.0, (double)paramTone.getTargetValue() * 0.05);
+    double gain = pow (10.0, (double)currentTone * 0.05);
+
+    filter.updateCoefficients (discreteFrequency, gain);
+}
+
+size_t DistortionAudioProcessor::getMemoryFootprint() const noexcept
+{
+    return sizeof (*this) + arena.getCapacity() + getOversamplerFootprint();
+}
+
+// dsp::Oversampling doesn't expose its buffers, so this is worked out from its
+// configuration. Every stage holds its output block for each channel, plus the
+// filter history: a few coefficients for the IIR designs, a few hundred taps
+// (up, down and the delayed branch) for the FIR ones.
+size_t DistortionAudioProcessor::getOversamplerFootprint() const noexcept
+{
+    if (oversampler == nullptr)
+        return 0;
 
-    for (int i = 0; i < filters.size(); ++i)
-        filters[i]->updateCoefficients (discreteFrequency, gain);
+    const QualityProfile& profile = *qualityProfile.load();
+    const size_t historyPerChannel = profile.oversamplingFilter == dsp::Oversampling<float>::filterHalfBandFIREquiripple ? 384 : 16;
+    size_t numFloats = 0;
+
+    for (int stage = 0; stage < profile.oversamplingOrder; ++stage)
+        numFloats += (size_t)oversamplerChannels * ((size_t)(preparedBlockSize << (stage + 1)) + historyPerChannel);
+
+    return sizeof (dsp::Oversampling<float>) + numFloats * sizeof (float);
 }
 
 //==============================================================================
@@ -234,7 +1128,7 @@ float DistortionAudioProcessor::doidicSymmetric(const float& _in)
 
 float DistortionAudioProcessor::doidicAssymetric(const float& _in)
 {
-    float out;
+    float out = 0.0f;
     
     if (_in >= -1 && _in < -0.08905f) {
         out = -(0.75)*( 1 - (1 - pow(fabs(_in) - 0.032847, 12)) + 1/3*(fabs(_in) - 0.032847)) + 0.01;
@@ -260,24 +1154,65 @@ float DistortionAudioProcessor::doidicAssymetric(const float& _in)
 
 void DistortionAudioProcessor::getStateInformation (MemoryBlock& destData)
 {
-    auto state = parameters.apvts.copyState();
-    std::unique_ptr<XmlElement> xml (state.createXml());
-    copyXmlToBinary (*xml, destData);
+    MemoryOutputStream stream (destData, false);
+    parameters.writeBinaryState (stream);
+
+    Array<int> controllers;
+
+    for (int controller = 0; controller < (int)midiControllerMap.size(); ++controller)
+        if (isPositiveAndBelow ((int)midiControllerMap[(size_t)controller], parameters.parameterIDs.size()))
+            controllers.add (controller);
+
+    stream.writeCompressedInt (controllers.size());
+
+    for (auto& controller : controllers) {
+        stream.writeCompressedInt (controller);
+        stream.writeString (parameters.parameterIDs[midiControllerMap[(size_t)controller]]);
+    }
 }
 
 void DistortionAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    std::unique_ptr<XmlElement> xmlState (getXmlFromBinary (data, sizeInBytes));
+    // Parameter changes trigger no work here; the audio thread picks up
+    // the whole restored state with its next parameter snapshot.
+    MemoryInputStream stream (data, (size_t)jmax (0, sizeInBytes), false);
+
+    const int version = PluginParametersManager::readBinaryState (stream,
+        [this](const String& paramID, float value){ parameters.setParameterValue (paramID, value); });
+
+    if (version >= 2) {
+        for (auto& mapping : midiControllerMap)
+            mapping = -1;
+
+        const int numMappings = stream.readCompressedInt();
+
+        for (int i = 0; i < numMappings && ! stream.isExhausted(); ++i) {
+            const int controller = stream.readCompressedInt();
+            const int index = parameters.parameterIDs.indexOf (stream.readString());
 
-    if (xmlState.get() != nullptr)
-        if (xmlState->hasTagName (parameters.apvts.state.getType()))
-            parameters.apvts.replaceState (ValueTree::fromXml (*xmlState));
+            if (isPositiveAndBelow (controller, (int)midiControllerMap.size()) && index >= 0)
+                midiControllerMap[(size_t)controller] = index;
+        }
+    }
+
+    if (version == 0) {
+        std::unique_ptr<XmlElement> xmlState (getXmlFromBinary (data, sizeInBytes));
+
+        if (xmlState.get() != nullptr)
+            if (xmlState->hasTagName (parameters.apvts.state.getType()))
+                parameters.apvts.replaceState (ValueTree::fromXml (*xmlState));
+    }
+
+    // Controller and program changes queued before the restore must not override it
+    // afterwards. Dropped only now, so the audio thread never sees the values from before.
+    clearPendingChanges();
 }
 
 //==============================================================================
 
 AudioProcessorEditor* DistortionAudioProcessor::createEditor()
 {
+    loadUserPresets();
     return new DistortionAudioProcessorEditor (*this);
 }
 
@@ -321,11 +1256,7 @@ const String DistortionAudioProcessor::getName() const
 
 bool DistortionAudioProcessor::acceptsMidi() const
 {
-   #if JucePlugin_WantsMidiInput
-    return true;
-   #else
-    return false;
-   #endif
+    return true; // Program changes and learned controllers drive the parameters
 }
 
 bool DistortionAudioProcessor::producesMidi() const
@@ -355,34 +1286,58 @@ double DistortionAudioProcessor::getTailLengthSeconds() const
 
 int DistortionAudioProcessor::getNumPrograms()
 {
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
-                // so this should be at least 1, even if you're not really implementing programs.
+    return jmax (1, presets->getNumPresets());   // NB: some hosts don't cope very well if you tell them there are 0 programs
 }
 
 int DistortionAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return currentProgram;
 }
 
 void DistortionAudioProcessor::setCurrentProgram (int index)
 {
+    if (! isPositiveAndBelow (index, presets->getNumPresets()))
+        return;
+
+    currentProgram = index;
+
+    // Hosts that call from another thread get it applied by the audio thread at the start of the next block
+    if (! MessageManager::existsAndIsCurrentThread()) {
+        pendingProgram = index;
+        return;
+    }
+
+    // On the message thread the values go straight to the parameters, so the change takes
+    // effect, and is saved with the state, even while the host isn't processing.
+    // It supersedes anything still queued from the audio thread.
+    const PresetBank::Snapshot& values = presets->getSnapshot (index);
+
+    for (int i = 0; i < parameters.parameterIDs.size(); ++i)
+        parameters.setParameterValue (parameters.parameterIDs[i], values.values[i]);
+
+    clearPendingChanges();
 }
 
 const String DistortionAudioProcessor::getProgramName (int index)
 {
-    return {};
+    return presets->getPresetName (index);
 }
 
 void DistortionAudioProcessor::changeProgramName (int index, const String& newName)
 {
+    presets->setPresetName (index, newName);
 }
 
 //==============================================================================
 
+#if ! DISTORTION_BUILD_RACK
+
 // This creates new instances of the plugin..
 AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 {
     return new DistortionAudioProcessor();
 }
 
+#endif
+
 //==============================================================================
@@ -5,12 +5,27 @@
 #define _USE_MATH_DEFINES
 #include <cmath>
 
-#include "../JuceLibraryCode/JuceHeader.h"
+#include <JuceHeader.h>
 #include "PluginParameter.h"
+#include "PresetBank.h"
+#include "DspArena.h"
+#include "NoiseGate.h"
+#include "DiodeClipper.h"
+#include "ToneStack.h"
+#include "MeterFifo.h"
+#include "BiasShift.h"
+
+// Set by the rack project (Rack/DistortionRack.jucer), which builds the same sources
+// as a separate plug-in with AmpRackAudioProcessor as its processor
+#ifndef DISTORTION_BUILD_RACK
+ #define DISTORTION_BUILD_RACK 0
+#endif
 
 //==============================================================================
 
-class DistortionAudioProcessor : public AudioProcessor
+class DistortionAudioProcessor : public AudioProcessor,
+                                 private AsyncUpdater,
+                                 private PresetBank::Listener
 {
 public:
     //==============================================================================
@@ -18,12 +33,18 @@ public:
     DistortionAudioProcessor();
     ~DistortionAudioProcessor();
 
+    // Instances are allocated cache-line aligned, for the parameter snapshot
+    static void* operator new (size_t size);
+    static void operator delete (void* pointer) noexcept;
+
     //==============================================================================
 
     void prepareToPlay (double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
     void processBlock (AudioSampleBuffer&, MidiBuffer&) override;
 
+    void setNonRealtime (bool isNonRealtime) noexcept override;
+
     //==============================================================================
 
 
@@ -73,16 +94,10 @@ public:
 
     //==============================================================================
 
-    StringArray distortionTypeItemsUI = {
-        "Hard clipping",
-        "Soft clipping",
-        "Exponential",
-        "Full-wave rectifier",
-        "Half-wave rectifier",
-        "Araya&Suyama System",
-        "Doidic Symmetric",
-        "Doidic Assymmetric"
-    };
+    // Shared by all instances; the combo box parameters reference these lists
+    static const StringArray distortionTypeItemsUI;
+    static const StringArray diodeSolverItemsUI;
+    static const StringArray stereoModeItemsUI;
 
     enum distortionTypeIndex {
         distortionTypeHardClipping = 0,
@@ -92,24 +107,43 @@ public:
         distortionTypeHalfWaveRectifier,
         distortionTypeArayaSuyama,
         distortionTypeDoidicSymmetric,
-        distortionTypeDoidicAssymetric
+        distortionTypeDoidicAssymetric,
+        distortionTypeDiodeClipper
     };
 
+    enum stereoModeIndex {
+        stereoModeDualMono = 0,     // Every channel gated and shaped on its own
+        stereoModeLinked,           // One gate envelope for all channels
+        stereoModeMidSide           // Stereo shaped as mid and side, with separate side drive
+    };
+
+
     
     //=================================================================
     
-    float hardClipping(const float& _in);
-    float softClipping(const float& _in);
-    float exponential(const float& _in);
-    float fullWaveRectifier(const float& _in);
-    float halfWaveRectifier(const float& _in);
-    float ArayaAndSuyama(const float& _in);
-    float doidicSymmetric(const float& _in);
-    float doidicAssymetric(const float& _in);
+    static float hardClipping(const float& _in);
+    static float softClipping(const float& _in);
+    static float exponential(const float& _in);
+    static float fullWaveRectifier(const float& _in);
+    static float halfWaveRectifier(const float& _in);
+    static float ArayaAndSuyama(const float& _in);
+    static float doidicSymmetric(const float& _in);
+    static float doidicAssymetric(const float& _in);
+
+    // Static input-output curve of each type, as the shaper applies it. The
+    // diode clipper's is its DC characteristic.
+    static float getTransferCurve (int distortionType, float in);
+
+    // Largest input magnitude each curve is defined for. Inputs are mapped into
+    // this domain inside the shaper kernel, so no automation or host setting can
+    // push a curve past its turning point or produce NaN/Inf.
+    static float getShaperDomain (int distortionType);
     
     //======================================
 
-    class Filter : public IIRFilter
+    // First-order shelf shared by all channels; each channel only owns one
+    // float of state, which lives in the DSP arena.
+    class Filter
     {
     public:
         void updateCoefficients (const double discreteFrequency,
@@ -120,22 +154,41 @@ public:
             double tan_half_wc = tan (discreteFrequency / 2.0);
             double sqrt_gain = sqrt (gain);
 
-            coefficients = IIRCoefficients (/* b0 */ sqrt_gain * tan_half_wc + gain,
-                                            /* b1 */ sqrt_gain * tan_half_wc - gain,
-                                            /* b2 */ 0.0,
-                                            /* a0 */ sqrt_gain * tan_half_wc + 1.0,
-                                            /* a1 */ sqrt_gain * tan_half_wc - 1.0,
-                                            /* a2 */ 0.0);
+            const double a0 = sqrt_gain * tan_half_wc + 1.0;
+
+            b0 = (float)((sqrt_gain * tan_half_wc + gain) / a0);
+            b1 = (float)((sqrt_gain * tan_half_wc - gain) / a0);
+            a1 = (float)((sqrt_gain * tan_half_wc - 1.0) / a0);
+        }
+
+        void processSamples (float* samples, const int numSamples, float& state) const noexcept
+        {
+            float v1 = state;
+
+            for (int i = 0; i < numSamples; ++i) {
+                const float in = samples[i];
+                const float out = b0 * in + v1;
+                v1 = b1 * in - a1 * out;
+                samples[i] = out;
+            }
+
+            state = v1;
+        }
 
-            setCoefficients (coefficients);
+        void getCoefficients (float& b0Out, float& b1Out, float& a1Out) const noexcept
+        {
+            b0Out = b0;
+            b1Out = b1;
+            a1Out = a1;
         }
+
+    private:
+        float b0 = 1.0f, b1 = 0.0f, a1 = 0.0f;
     };
 
-    OwnedArray<Filter> filters;
+    Filter filter;
     void updateFilters();
 
-   // dsp::Oversampling<float>* oversampledBlock = new dsp::Oversampling<float> (2,2, dsp::Oversampling<float>::FilterType::filterHalfBandFIREquiripple);
-    
     //======================================
 
     PluginParametersManager parameters;
@@ -144,7 +197,103 @@ public:
     PluginParameterLinSlider paramInputGain;
     PluginParameterLinSlider paramOutputGain;
     PluginParameterLinSlider paramTone;
-    
+    PluginParameterLinSlider paramGateThreshold;
+    PluginParameterLinSlider paramGateHysteresis;
+    PluginParameterToggle paramGateLookahead;
+    PluginParameterComboBox paramDiodeSolver;
+    PluginParameterToggle paramToneStack;
+    PluginParameterLinSlider paramBass;
+    PluginParameterLinSlider paramMiddle;
+    PluginParameterLinSlider paramTreble;
+    PluginParameterComboBox paramStereoMode;
+    PluginParameterLinSlider paramSideDrive;
+    PluginParameterLinSlider paramBiasShift;
+
+    //======================================
+
+    SharedResourcePointer<PresetBank> presets;
+
+    //======================================
+
+    void startMidiLearn (int parameterIndex);
+    void clearMidiMapping (int parameterIndex);
+    int getMidiController (int parameterIndex) const;
+
+    //======================================
+
+    // Host buffers of any length are processed in sub-blocks of at most this many
+    // samples, which keeps the working set in L1 and bounds all internal buffers.
+    // Takes effect at the next prepareToPlay.
+    void setInternalBlockSize (int numSamples);
+    int getInternalBlockSize() const noexcept { return internalBlockSize; }
+
+    // Bytes of memory this instance holds for processing, for profiling large sessions.
+    // The oversampler's share is an estimate, as JUCE keeps those buffers private.
+    size_t getMemoryFootprint() const noexcept;
+
+    //======================================
+
+    // Everything that trades CPU for quality. The render profile is used automatically
+    // whenever the host processes offline, e.g. while bouncing a mixdown.
+    struct QualityProfile
+    {
+        int oversamplingOrder;  // Factor 2^order
+        dsp::Oversampling<float>::FilterType oversamplingFilter;
+        int diodeClipperIterations;
+        int diodeClipperTableSize;
+    };
+
+    static const QualityProfile realtimeProfile;
+    static const QualityProfile renderProfile;
+
+    const QualityProfile& getQualityProfile() const noexcept { return *qualityProfile.load(); }
+
+    // Forces a profile regardless of the processing mode, for measurements; nullptr
+    // restores the automatic choice. Takes effect at the next prepareToPlay.
+    void setQualityProfileOverride (const QualityProfile* profile);
+
+    //======================================
+
+    // Levels and the output envelope of one sub-block, for the editor's meters and scope.
+    // Drive is the signal going into the shaper.
+    struct MeterFrame
+    {
+        float drivePeak;
+        float driveSquares;
+        float outputPeak;
+        float outputSquares;
+        float outputMin;
+        float outputMax;
+        int numSamples;     // Summed over channels, to turn the squares into RMS
+    };
+
+    bool popMeterFrame (MeterFrame& frame) noexcept { return meterFifo.pop (frame); }
+
+    // Metering costs nothing while no editor is listening
+    void setMeteringEnabled (bool shouldMeter) noexcept { meteringEnabled = shouldMeter; }
+
+    //======================================
+
+    // How often the realtime guard has stepped in since the instance was created,
+    // for logging. Every trip silences the block, resets all DSP state and fades
+    // the output back in.
+    struct GuardStatistics
+    {
+        uint32 outputTrips;     // Blocks with a NaN or an Inf in the output
+        uint32 stateTrips;      // Blocks that left one in a recursive state
+    };
+
+    GuardStatistics getGuardStatistics() const noexcept
+    {
+        return { outputTrips.load (std::memory_order_relaxed), stateTrips.load (std::memory_order_relaxed) };
+    }
+
+    enum
+    {
+        minInternalBlockSize = 16,
+        maxInternalBlockSize = 1024,
+        defaultInternalBlockSize = 64
+    };
 
 private:
     //==============================================================================
@@ -157,22 +306,161 @@ private:
     };
 
 
-    dsp::Gain<float> inputGain, outputGain;
+    //======================================
 
-    std::array<dsp::WaveShaper<float, std::function<float(float)>>, 8> waveShapers {
-        { { [this](float _in){ return hardClipping(_in); } },
-          { [this](float _in){ return softClipping(_in); } },
-          { [this](float _in){ return exponential(_in); } },
-          { [this](float _in){ return fullWaveRectifier(_in); } },
-          { [this](float _in){ return halfWaveRectifier(_in); } },
-          { [this](float _in){ return ArayaAndSuyama(_in); } },
-          { [this](float _in){ return doidicSymmetric(_in); } },
-          { [this](float _in){ return doidicAssymetric(_in); } }
-            
-        } };
-    
-    dsp::DryWetMixer<float> mixer { 10 };
-    dsp::Oversampling<float> oversampler { 2, 3, dsp::Oversampling<float>::filterHalfBandPolyphaseIIR, true, false };
+    // Everything the audio thread needs from the parameters, read once per
+    // (sub-)block from the APVTS atomics. Gains are linear, the rest plain values.
+    struct alignas (64) ParameterSnapshot
+    {
+        float inputGain = 1.0f;
+        float outputGain = 1.0f;
+        float tone = 0.0f;
+        float gateThreshold = -96.0f;
+        float gateHysteresis = 0.0f;
+        float bass = 0.5f;
+        float middle = 0.5f;
+        float treble = 0.5f;
+        float sideGain = 1.0f;
+        float biasShift = 0.0f;
+        int distortionType = 0;
+        int diodeSolver = 0;
+        int stereoMode = 0;
+        bool gateLookahead = false;
+        bool toneStack = false;
+    };
+
+    ParameterSnapshot snapshot;
+    float currentTone = 0.0f;
+
+    void pullParameters() noexcept;
+    float readParameter (const PluginParameter& parameter) const noexcept;
+
+    //======================================
+
+    int internalBlockSize = defaultInternalBlockSize;
+    int preparedBlockSize = defaultInternalBlockSize; // What the buffers were sized for
+
+    void processRange (AudioSampleBuffer& buffer, int startSample, int numSamples);
+    void processSubBlock (AudioSampleBuffer& buffer, int startSample, int numSamples);
+    void handleMidiEvent (const MidiMessage& message);
+
+    static void measureLevels (const dsp::AudioBlock<float>& block, float& peak, float& squares,
+                               float& minimum, float& maximum) noexcept;
+    static float getSumOfSquares (const float* samples, int numSamples) noexcept;
+
+   #if JUCE_DEBUG
+    void checkOutput (const AudioSampleBuffer& buffer);
+   #endif
+
+    std::array<std::atomic<int>, 128> midiControllerMap; // Parameter index driven by each CC, or -1
+    std::atomic<int> midiLearnParameter { -1 };
+
+    //======================================
+
+    void applyProgram (int index);
+    void setParameterFromAudioThread (int index, float value);
+    void clearPendingChanges() noexcept;
+    void handleAsyncUpdate() override;
+    void presetsLoaded() override;
+
+    std::atomic<int> currentProgram { 0 };
+    std::atomic<int> pendingProgram { -1 };
+
+    void loadUserPresets();
+
+    //======================================
+
+    // All realtime state, allocated once in prepareToPlay
+    DspArena arena;
+    float* filterStates = nullptr;
+    int numFilterStates = 0;
+
+    //======================================
+
+    // Values changed on the audio thread, waiting to be pushed to the host from the message thread,
+    // or NaN if there is none. Until the APVTS has them, they take precedence over its values.
+    std::array<std::atomic<float>, PresetBank::maxNumParameters> pendingHostValues;
+    std::atomic<bool> presetListChanged { false };
+    std::atomic<bool> latencyChanged { false };
+    std::atomic<bool> qualityChanged { false };
+
+    //======================================
+
+    // One frame per internal block: 256 cover an editor refresh at 192 kHz with
+    // 64-sample blocks. Smaller blocks than that only drop a few readings.
+    MeterFifo<MeterFrame, 256> meterFifo;
+    std::atomic<bool> meteringEnabled { false };
+
+    //======================================
+
+    bool applyGuard (dsp::AudioBlock<float>& block, float outputSquares) noexcept;
+    void resetDspState() noexcept;
+
+    const double recoveryTime = 20e-3;
+    int recoveryLength = 0;
+    int recoveryRemaining = 0;
+    std::atomic<uint32> outputTrips { 0 };
+    std::atomic<uint32> stateTrips { 0 };
+
+    //======================================
+
+    void processShaper (dsp::AudioBlock<float>& block);
+    void applyShaper (int distortionType, dsp::AudioBlock<float>& block);
+
+    const double switchTime = 10e-3;
+    int currentDistortionType = -1;
+    int previousDistortionType = -1;
+    int shaperCrossfadeLength = 0;
+    int shaperCrossfadeRemaining = 0;
+    float** crossfadeChannels = nullptr;
+    int numCrossfadeChannels = 0;
+    int crossfadeBufferSize = 0;
+
+    //======================================
+
+    NoiseGate noiseGate;
+    DiodeClipper diodeClipper;
+    BiasShift biasShift;
+    ToneStack toneStack;
+    float toneStackMix = 0.0f;  // 0 bypassed, 1 fully in, between while switching
+    float toneStackStep = 0.0f;
+
+    void processToneStackFade (dsp::AudioBlock<float>& block, float targetMix) noexcept;
+
+    //======================================
+
+    bool isMidSide (const dsp::AudioBlock<float>& block) const noexcept;
+    void applyInputStage (dsp::AudioBlock<float>& block) noexcept;
+    void applyOutputStage (dsp::AudioBlock<float>& block) noexcept;
+    void applyGain (dsp::AudioBlock<float>& block, LinearSmoothedValue<float>& gain) noexcept;
+    bool fadeOutForStereoSwitch (dsp::AudioBlock<float>& block) noexcept;
+
+    LinearSmoothedValue<float> inputGain, outputGain, sideGain;
+
+    // Program changes and automation glide with the gains, so none of these jump either.
+    // The gate's threshold and hysteresis need no smoothing: the gate's own attack and
+    // release already smooth what they do. Its lookahead changes the latency, which the
+    // host has to re-align anyway, so that switch is immediate.
+    LinearSmoothedValue<float> smoothedTone, smoothedBass, smoothedMiddle, smoothedTreble;
+    float* gainRamp = nullptr;
+    int currentStereoMode = -1;
+    int stereoFadeLength = 0;
+    int stereoFadeRemaining = 0;
+
+    //======================================
+
+    // The shaper runs oversampled; the oversampler is rebuilt when the profile changes
+    std::atomic<const QualityProfile*> qualityProfile { &realtimeProfile };
+    QualityProfile profileOverride {};
+    bool hasProfileOverride = false;
+    std::unique_ptr<dsp::Oversampling<float>> oversampler;
+    int oversamplerChannels = 0;
+
+    size_t getOversamplerFootprint() const noexcept;
+
+    const QualityProfile& getTargetProfile() const noexcept;
+    void switchQualityProfile();
+    int getLatency() const noexcept;
 
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DistortionAudioProcessor)
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginParameter.h"
+
+//==============================================================================
+
+// Holds every program as a ready-to-apply table of parameter values, so that the
+// audio thread can switch programs without parsing or allocating anything.
+// Factory presets are added up front; user presets (files written in the binary
+// state format) are decoded on a background thread and appended as they load.
+// One bank serves every instance in the process: hold it through a
+// SharedResourcePointer, so a session with many instances scans the folder once.
+
+class PresetBank : private Thread
+{
+public:
+    enum
+    {
+        maxNumPresets = 128,
+        maxNumParameters = 32
+    };
+
+    struct Snapshot
+    {
+        float values[maxNumParameters]; // Unnormalised values, in PluginParametersManager::parameterIDs order
+    };
+
+    //======================================
+
+    PresetBank() : Thread ("Preset loader")
+    {
+        snapshots.calloc (maxNumPresets);
+    }
+
+    ~PresetBank()
+    {
+        stopLoading();
+    }
+
+    //======================================
+
+    // Only the first instance sets up the bank. Returns true for that instance, which
+    // should then add the factory presets.
+    bool initialise (PluginParametersManager& parametersManager)
+    {
+        const ScopedLock sl (initialiseLock);
+
+        if (! parameterIDs.isEmpty())
+            return false;
+
+        jassert (parametersManager.parameterIDs.size() <= maxNumParameters);
+
+        parameterIDs = parametersManager.parameterIDs;
+
+        for (int i = 0; i < parameterIDs.size(); ++i) {
+            RangedAudioParameter* parameter = parametersManager.apvts.getParameter (parameterIDs[i]);
+            defaults.values[i] = parameter->convertFrom0to1 (parameter->getDefaultValue());
+        }
+
+        return true;
+    }
+
+    void addFactoryPreset (const String& name, std::initializer_list<std::pair<const char*, float>> values)
+    {
+        Snapshot snapshot (defaults);
+
+        for (auto& value : values)
+            setSnapshotValue (snapshot, value.first, value.second);
+
+        addPreset (name, snapshot);
+    }
+
+    // Scans the user preset folder on the background thread, once per bank; later
+    // calls do nothing. Listeners are called from that thread once the bank has grown.
+    void loadUserPresets (const File& folder)
+    {
+        if (userPresetsRequested.exchange (true))
+            return;
+
+        userPresetFolder = folder;
+        startThread (3);
+    }
+
+    void stopLoading()
+    {
+        stopThread (2000);
+    }
+
+    //======================================
+
+    struct Listener
+    {
+        virtual ~Listener() = default;
+        virtual void presetsLoaded() = 0;
+    };
+
+    // Once removeListener returns, the listener is no longer being called
+    void addListener (Listener* listener)
+    {
+        const ScopedLock sl (listenersLock);
+        listeners.add (listener);
+    }
+
+    void removeListener (Listener* listener)
+    {
+        const ScopedLock sl (listenersLock);
+        listeners.remove (listener);
+    }
+
+    //======================================
+
+    int getNumPresets() const noexcept
+    {
+        return numPresets.load (std::memory_order_acquire);
+    }
+
+    // Safe to call from the audio thread for any index below getNumPresets()
+    const Snapshot& getSnapshot (const int index) const noexcept
+    {
+        jassert (isPositiveAndBelow (index, getNumPresets()));
+        return snapshots[index];
+    }
+
+    String getPresetName (const int index) const
+    {
+        const ScopedLock sl (namesLock);
+        return names[index];
+    }
+
+    // The names are shared too, so a renamed program is renamed in every instance
+    void setPresetName (const int index, const String& newName)
+    {
+        const ScopedLock sl (namesLock);
+
+        if (isPositiveAndBelow (index, names.size()))
+            names.set (index, newName);
+    }
+
+private:
+    //==============================================================================
+
+    void run() override
+    {
+        Array<File> files = userPresetFolder.findChildFiles (File::findFiles, false, "*.preset");
+        files.sort();
+
+        bool addedPresets = false;
+
+        for (auto& file : files) {
+            if (threadShouldExit() || getNumPresets() >= maxNumPresets)
+                break;
+
+            MemoryBlock data;
+            Snapshot snapshot (defaults);
+
+            if (file.loadFileAsData (data)
+                && PluginParametersManager::readBinaryState (data.getData(), (int)data.getSize(),
+                       [this, &snapshot](const String& paramID, float value){ setSnapshotValue (snapshot, paramID, value); })) {
+                addPreset (file.getFileNameWithoutExtension(), snapshot);
+                addedPresets = true;
+            }
+        }
+
+        if (addedPresets) {
+            const ScopedLock sl (listenersLock);
+            listeners.call ([](Listener& listener){ listener.presetsLoaded(); });
+        }
+    }
+
+    void setSnapshotValue (Snapshot& snapshot, const String& paramID, const float value) const
+    {
+        const int index = parameterIDs.indexOf (paramID);
+
+        if (index >= 0)
+            snapshot.values[index] = value;
+    }
+
+    void addPreset (const String& name, const Snapshot& snapshot)
+    {
+        const int index = getNumPresets();
+
+        if (index >= maxNumPresets)
+            return;
+
+        snapshots[index] = snapshot;
+
+        {
+            const ScopedLock sl (namesLock);
+            names.add (name);
+        }
+
+        // Publish only once the slot is fully written; slots are never modified afterwards
+        numPresets.store (index + 1, std::memory_order_release);
+    }
+
+    //==============================================================================
+
+    HeapBlock<Snapshot> snapshots;
+    std::atomic<int> numPresets { 0 };
+
+    StringArray names;
+    CriticalSection namesLock;
+
+    StringArray parameterIDs;
+    Snapshot defaults {};
+    CriticalSection initialiseLock;
+
+    File userPresetFolder;
+    std::atomic<bool> userPresetsRequested { false };
+
+    ListenerList<Listener> listeners;
+    CriticalSection listenersLock;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PresetBank)
+};
+
+//==============================================================================
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+
+// Checks on the recursive state of the DSP components. A NaN or an Inf that
+// gets into a feedback path never decays out of it, and a state decaying towards
+// silence spends a long time in denormals, which cost many times the CPU of
+// normal numbers wherever the host doesn't flush them.
+//
+// Every stateful component has a bool sanitiseState() that runs these over its
+// few state values: it flushes denormals out of the state and returns false if
+// the state holds a NaN or an Inf. The processor calls them after every
+// sub-block, and resets all the state if any of them fails.
+
+struct StateGuard
+{
+    // Below anything audible, but far above the denormal range
+    static constexpr float flushThreshold = 1e-15f;
+
+    // Flushes a tiny value to zero; returns false if the value is not finite
+    static bool sanitise (float& value) noexcept
+    {
+        if (std::abs (value) < flushThreshold)
+            value = 0.0f;
+
+        return std::isfinite (value);
+    }
+
+    static bool sanitise (float* values, const int numValues) noexcept
+    {
+        bool isFinite = true;
+
+        for (int i = 0; i < numValues; ++i)
+            isFinite = sanitise (values[i]) && isFinite;
+
+        return isFinite;
+    }
+};
+
+//==============================================================================
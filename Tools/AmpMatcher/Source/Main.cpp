@@ -0,0 +1,565 @@
+/*
+  Headless fitting of the plugin's parameters to a reference recording.
+
+  Given a DI recording and the same performance recorded through the amp to be
+  matched, searches the distortion type, input gain and tone for the setting
+  whose output is closest to the reference, and writes it as a preset:
+
+      AmpMatcher --di di.wav --reference amp.wav [--output Matched.preset]
+                 [--seconds 8] [--starts 4] [--evaluations 80] [--threads N]
+                 [--spectral-weight 1] [--max-lag-ms 20]
+
+  Every distortion type is searched from several starting drives with a
+  Nelder-Mead simplex over input gain and tone. The searches run in parallel,
+  one worker thread per core, each rendering candidates through its own
+  processor instance. The output gain is not searched: every candidate is
+  level-matched to the reference, and the preset gets that gain.
+
+  The loss adds a time-domain term (the normalised error after level matching,
+  2 (1 - correlation)) and a spectral term (the mean squared difference, in units
+  of 10 dB, of the long-term spectra in sixth-octave bands). The reference is
+  aligned to the DI by cross-correlation first, and the plugin's latency is
+  compensated. Copy the preset into the plugin's user preset folder to use it.
+*/
+
+#include <iostream>
+#include "../../../Source/PluginProcessor.h"
+
+//==============================================================================
+
+namespace
+{
+    enum
+    {
+        spectrumOrder = 12,
+        spectrumSize = 1 << spectrumOrder,
+        maxNumBands = 128
+    };
+
+    const float minDrive = -24.0f, maxDrive = 24.0f;
+    const float minTone = -24.0f, maxTone = 24.0f;
+
+    //==============================================================================
+
+    // Long-term average spectrum in sixth-octave bands, in dB
+    class BandAnalyser
+    {
+    public:
+        BandAnalyser (const double sampleRate)
+        {
+            const double binWidth = sampleRate / spectrumSize;
+            const double lastFrequency = jmin (16000.0, 0.45 * sampleRate);
+
+            for (double low = 50.0; low * std::pow (2.0, 1.0 / 6.0) <= lastFrequency && numBands < maxNumBands;
+                 low *= std::pow (2.0, 1.0 / 6.0)) {
+                bandStart[numBands] = jmax (1, roundToInt (low / binWidth));
+                bandEnd[numBands] = jmax (bandStart[numBands] + 1, roundToInt (low * std::pow (2.0, 1.0 / 6.0) / binWidth));
+                ++numBands;
+            }
+
+            for (int i = 0; i < spectrumSize; ++i)
+                window[i] = 0.5f - 0.5f * std::cos (MathConstants<float>::twoPi * i / spectrumSize);
+        }
+
+        int getNumBands() const noexcept { return numBands; }
+
+        void analyse (const float* samples, const int numSamples, float* bandLevels)
+        {
+            FloatVectorOperations::clear (power.data(), spectrumSize / 2 + 1);
+            int numFrames = 0;
+
+            for (int start = 0; start + spectrumSize <= numSamples; start += spectrumSize / 2) {
+                FloatVectorOperations::multiply (scratch.data(), samples + start, window.data(), spectrumSize);
+                FloatVectorOperations::clear (scratch.data() + spectrumSize, spectrumSize);
+                fft.performFrequencyOnlyForwardTransform (scratch.data());
+
+                for (int bin = 0; bin <= spectrumSize / 2; ++bin)
+                    power[(size_t)bin] += scratch[(size_t)bin] * scratch[(size_t)bin];
+
+                ++numFrames;
+            }
+
+            for (int band = 0; band < numBands; ++band) {
+                float sum = 0.0f;
+
+                for (int bin = bandStart[band]; bin < bandEnd[band]; ++bin)
+                    sum += power[(size_t)bin];
+
+                bandLevels[band] = 10.0f * std::log10 (sum / jmax (1, numFrames) + 1.0e-20f);
+            }
+        }
+
+    private:
+        dsp::FFT fft { spectrumOrder };
+        std::array<float, spectrumSize> window;
+        std::array<float, 2 * spectrumSize> scratch;
+        std::array<float, spectrumSize / 2 + 1> power;
+
+        int bandStart[maxNumBands];
+        int bandEnd[maxNumBands];
+        int numBands = 0;
+    };
+
+    //==============================================================================
+
+    // Everything the workers share, read-only once the search starts
+    struct MatchTarget
+    {
+        double sampleRate = 0.0;
+        int numSamples = 0;
+        AudioSampleBuffer di;
+        AudioSampleBuffer reference;
+        double referenceSquares = 0.0;
+        float referenceBands[maxNumBands];
+        float spectralWeight = 1.0f;
+        int maxEvaluations = 80;
+    };
+
+    struct SearchJob
+    {
+        int distortionType;
+        float startDrive;
+    };
+
+    struct MatchResult
+    {
+        double loss = std::numeric_limits<double>::max();
+        int distortionType = 0;
+        float inputGain = 0.0f;
+        float tone = 0.0f;
+        float outputGain = 0.0f;
+        int numEvaluations = 0;
+    };
+
+    //==============================================================================
+
+    // Runs search jobs until none are left, rendering every candidate through its own processor
+    class MatchWorker : public Thread
+    {
+    public:
+        MatchWorker (const MatchTarget& matchTarget, const Array<SearchJob>& searchJobs,
+                     std::atomic<int>& jobCounter, Array<MatchResult>& jobResults)
+            : Thread ("Amp matcher"),
+              target (matchTarget), jobs (searchJobs), nextJob (jobCounter), results (jobResults),
+              analyser (matchTarget.sampleRate)
+        {
+            AudioProcessor::BusesLayout layout;
+            layout.inputBuses.add (AudioChannelSet::mono());
+            layout.outputBuses.add (AudioChannelSet::mono());
+            processor->setBusesLayout (layout);
+
+            // Candidates are compared with what the plugin sounds like while playing
+            processor->setQualityProfileOverride (&DistortionAudioProcessor::realtimeProfile);
+            processor->setInternalBlockSize (DistortionAudioProcessor::maxInternalBlockSize);
+            processor->parameters.setParameterValue ("gatethreshold", -96.0f);
+            processor->parameters.setParameterValue ("outputgain", 0.0f);
+        }
+
+        void run() override
+        {
+            for (int job = nextJob++; job < jobs.size() && ! threadShouldExit(); job = nextJob++)
+                results.getReference (job) = search (jobs[job]);
+        }
+
+    private:
+        //==============================================================================
+
+        struct Vertex
+        {
+            float x[2];     // Input gain and tone, normalised to [0, 1]
+            double loss;
+            float outputGain;
+        };
+
+        MatchResult search (const SearchJob& job)
+        {
+            const int type = job.distortionType;
+            int numEvaluations = 0;
+
+            auto evaluateVertex = [&](Vertex& vertex) {
+                for (auto& x : vertex.x)
+                    x = jlimit (0.0f, 1.0f, x);
+
+                vertex.loss = evaluate (type, toDrive (vertex.x[0]), toTone (vertex.x[1]), vertex.outputGain);
+                ++numEvaluations;
+            };
+
+            const float start = (job.startDrive - minDrive) / (maxDrive - minDrive);
+            Vertex simplex[3] = { { { start, 0.5f } }, { { start + 0.15f, 0.5f } }, { { start, 0.65f } } };
+
+            for (auto& vertex : simplex)
+                evaluateVertex (vertex);
+
+            while (numEvaluations < target.maxEvaluations && ! threadShouldExit()) {
+                std::sort (std::begin (simplex), std::end (simplex),
+                           [](const Vertex& a, const Vertex& b) { return a.loss < b.loss; });
+
+                // Converged to well below a tenth of a dB
+                const float size = jmax (std::abs (simplex[2].x[0] - simplex[0].x[0]), std::abs (simplex[2].x[1] - simplex[0].x[1]),
+                                         std::abs (simplex[1].x[0] - simplex[0].x[0]), std::abs (simplex[1].x[1] - simplex[0].x[1]));
+
+                if (size < 1.0e-3f)
+                    break;
+
+                auto towards = [&](const float factor) {
+                    Vertex vertex;
+
+                    for (int d = 0; d < 2; ++d) {
+                        const float centroid = 0.5f * (simplex[0].x[d] + simplex[1].x[d]);
+                        vertex.x[d] = centroid + factor * (simplex[2].x[d] - centroid);
+                    }
+
+                    evaluateVertex (vertex);
+                    return vertex;
+                };
+
+                const Vertex reflected = towards (-1.0f);
+
+                if (reflected.loss < simplex[0].loss) {
+                    const Vertex expanded = towards (-2.0f);
+                    simplex[2] = expanded.loss < reflected.loss ? expanded : reflected;
+                }
+                else if (reflected.loss < simplex[1].loss) {
+                    simplex[2] = reflected;
+                }
+                else {
+                    const Vertex contracted = towards (reflected.loss < simplex[2].loss ? -0.5f : 0.5f);
+
+                    if (contracted.loss < jmin (reflected.loss, simplex[2].loss)) {
+                        simplex[2] = contracted;
+                    }
+                    else {
+                        for (int v = 1; v < 3; ++v) {
+                            for (int d = 0; d < 2; ++d)
+                                simplex[v].x[d] = simplex[0].x[d] + 0.5f * (simplex[v].x[d] - simplex[0].x[d]);
+
+                            evaluateVertex (simplex[v]);
+                        }
+                    }
+                }
+            }
+
+            const Vertex& best = *std::min_element (std::begin (simplex), std::end (simplex),
+                                                    [](const Vertex& a, const Vertex& b) { return a.loss < b.loss; });
+
+            MatchResult result;
+            result.loss = best.loss;
+            result.distortionType = type;
+            result.inputGain = toDrive (best.x[0]);
+            result.tone = toTone (best.x[1]);
+            result.outputGain = best.outputGain;
+            result.numEvaluations = numEvaluations;
+            return result;
+        }
+
+        //==============================================================================
+
+        double evaluate (const int type, const float drive, const float tone, float& outputGain)
+        {
+            outputGain = 0.0f;
+
+            auto& parameters = processor->parameters;
+            parameters.setParameterValue ("distortiontype", (float)type);
+            parameters.setParameterValue ("inputgain", drive);
+            parameters.setParameterValue ("tone", tone);
+
+            // Every candidate starts from a clean state, without parameter ramps
+            processor->prepareToPlay (target.sampleRate, DistortionAudioProcessor::maxInternalBlockSize);
+
+            const int latency = processor->getLatencySamples();
+            buffer.setSize (1, target.numSamples + latency, false, false, true);
+            buffer.clear();
+            buffer.copyFrom (0, 0, target.di, 0, 0, target.numSamples);
+            processor->processBlock (buffer, midi);
+
+            const float* output = buffer.getReadPointer (0, latency);
+            const float* reference = target.reference.getReadPointer (0);
+
+            double outputSquares = 0.0, product = 0.0;
+
+            for (int i = 0; i < target.numSamples; ++i) {
+                outputSquares += (double)output[i] * output[i];
+                product += (double)output[i] * reference[i];
+            }
+
+            if (! (outputSquares > 1.0e-12))
+                return std::numeric_limits<double>::max();
+
+            // Level-matched: the gain that gives the output the reference's RMS
+            const double gain = std::sqrt (target.referenceSquares / outputSquares);
+            outputGain = (float)Decibels::gainToDecibels (gain, -100.0);
+
+            const double timeLoss = 2.0 - 2.0 * gain * product / target.referenceSquares;
+
+            float bands[maxNumBands];
+            analyser.analyse (output, target.numSamples, bands);
+            double spectralLoss = 0.0;
+
+            for (int band = 0; band < analyser.getNumBands(); ++band) {
+                const double difference = (bands[band] + outputGain - target.referenceBands[band]) * 0.1;
+                spectralLoss += difference * difference;
+            }
+
+            spectralLoss /= jmax (1, analyser.getNumBands());
+
+            return timeLoss + target.spectralWeight * spectralLoss;
+        }
+
+        static float toDrive (const float x) noexcept { return minDrive + x * (maxDrive - minDrive); }
+        static float toTone (const float x) noexcept { return minTone + x * (maxTone - minTone); }
+
+        //==============================================================================
+
+        const MatchTarget& target;
+        const Array<SearchJob>& jobs;
+        std::atomic<int>& nextJob;
+        Array<MatchResult>& results;
+
+        // Allocated separately, through its aligned operator new; as a plain member it
+        // would make the worker itself over-aligned
+        std::unique_ptr<DistortionAudioProcessor> processor { new DistortionAudioProcessor() };
+        BandAnalyser analyser;
+        AudioSampleBuffer buffer;
+        MidiBuffer midi;
+    };
+
+    //==============================================================================
+
+    // Mono mix of a whole file
+    bool readAudioFile (AudioFormatManager& formats, const File& file, AudioSampleBuffer& audio, double& sampleRate)
+    {
+        std::unique_ptr<AudioFormatReader> reader (formats.createReaderFor (file));
+
+        if (reader == nullptr || reader->lengthInSamples <= 0 || reader->lengthInSamples > std::numeric_limits<int>::max()) {
+            std::cerr << "Could not read " << file.getFullPathName() << std::endl;
+            return false;
+        }
+
+        const int numChannels = (int)reader->numChannels;
+        const int numSamples = (int)reader->lengthInSamples;
+        AudioSampleBuffer channels (numChannels, numSamples);
+        reader->read (&channels, 0, numSamples, 0, true, true);
+
+        audio.setSize (1, numSamples);
+        audio.clear();
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            audio.addFrom (0, 0, channels, channel, 0, numSamples, 1.0f / numChannels);
+
+        sampleRate = reader->sampleRate;
+        return true;
+    }
+
+    // Delay of the reference relative to the DI, from the peak of their cross-correlation
+    int findLag (const AudioSampleBuffer& di, const AudioSampleBuffer& reference, const int maxLag)
+    {
+        if (maxLag <= 0)
+            return 0;
+
+        const int length = jmin (di.getNumSamples(), reference.getNumSamples(), 1 << 17);
+        const int order = jmax (1, (int)std::ceil (std::log2 (2.0 * length)));
+        const int size = 1 << order;
+
+        dsp::FFT fft (order);
+        HeapBlock<dsp::Complex<float>> a ((size_t)size, true), b ((size_t)size, true);
+        HeapBlock<dsp::Complex<float>> spectrumA ((size_t)size), spectrumB ((size_t)size);
+
+        for (int i = 0; i < length; ++i) {
+            a[i] = di.getSample (0, i);
+            b[i] = reference.getSample (0, i);
+        }
+
+        fft.perform (a, spectrumA, false);
+        fft.perform (b, spectrumB, false);
+
+        for (int i = 0; i < size; ++i)
+            spectrumB[i] *= std::conj (spectrumA[i]);
+
+        fft.perform (spectrumB, a, true);
+
+        int lag = 0;
+        float peak = -1.0f;
+
+        for (int k = -maxLag; k <= maxLag; ++k) {
+            const float value = std::abs (a[(k + size) % size].real());
+
+            if (value > peak) {
+                peak = value;
+                lag = k;
+            }
+        }
+
+        return lag;
+    }
+}
+
+//==============================================================================
+
+int main (int argc, char* argv[])
+{
+    ScopedJuceInitialiser_GUI juceInitialiser;
+
+    StringArray arguments;
+
+    for (int i = 1; i < argc; ++i)
+        arguments.add (argv[i]);
+
+    auto getOption = [&arguments](const String& name, const String& defaultValue) {
+        const int index = arguments.indexOf (name);
+        return index >= 0 && index + 1 < arguments.size() ? arguments[index + 1] : defaultValue;
+    };
+
+    const File workingDirectory = File::getCurrentWorkingDirectory();
+    const String diPath = getOption ("--di", {});
+    const String referencePath = getOption ("--reference", {});
+
+    if (diPath.isEmpty() || referencePath.isEmpty()) {
+        std::cerr << "Usage: AmpMatcher --di di.wav --reference amp.wav [--output Matched.preset] [--seconds 8]" << std::endl
+                  << "       [--starts 4] [--evaluations 80] [--threads N] [--spectral-weight 1] [--max-lag-ms 20]" << std::endl;
+        return 1;
+    }
+
+    const File referenceFile = workingDirectory.getChildFile (referencePath);
+    const File outputFile = workingDirectory.getChildFile (getOption ("--output", referenceFile.getFileNameWithoutExtension() + ".preset"));
+    const double seconds = getOption ("--seconds", "8").getDoubleValue();
+    const int numStarts = jmax (1, getOption ("--starts", "4").getIntValue());
+    const int numThreads = jmax (1, getOption ("--threads", String (SystemStats::getNumCpus())).getIntValue());
+    const double maxLagMilliseconds = getOption ("--max-lag-ms", "20").getDoubleValue();
+
+    MatchTarget target;
+    target.maxEvaluations = jmax (3, getOption ("--evaluations", "80").getIntValue());
+    target.spectralWeight = getOption ("--spectral-weight", "1").getFloatValue();
+
+    //======================================
+
+    AudioFormatManager formats;
+    formats.registerBasicFormats();
+
+    AudioSampleBuffer di, reference;
+    double referenceSampleRate = 0.0;
+
+    if (! readAudioFile (formats, workingDirectory.getChildFile (diPath), di, target.sampleRate)
+        || ! readAudioFile (formats, referenceFile, reference, referenceSampleRate))
+        return 1;
+
+    if (referenceSampleRate != target.sampleRate) {
+        std::cerr << "The DI and the reference must have the same sample rate" << std::endl;
+        return 1;
+    }
+
+    const int lag = findLag (di, reference, roundToInt (maxLagMilliseconds * 1.0e-3 * target.sampleRate));
+    const int diOffset = jmax (0, -lag);
+    const int referenceOffset = jmax (0, lag);
+
+    target.numSamples = jmin (di.getNumSamples() - diOffset, reference.getNumSamples() - referenceOffset,
+                              roundToInt (seconds * target.sampleRate));
+
+    if (target.numSamples < 2 * spectrumSize) {
+        std::cerr << "The recordings are too short to match" << std::endl;
+        return 1;
+    }
+
+    target.di.setSize (1, target.numSamples);
+    target.di.copyFrom (0, 0, di, 0, diOffset, target.numSamples);
+    target.reference.setSize (1, target.numSamples);
+    target.reference.copyFrom (0, 0, reference, 0, referenceOffset, target.numSamples);
+
+    for (int i = 0; i < target.numSamples; ++i)
+        target.referenceSquares += (double)target.reference.getSample (0, i) * target.reference.getSample (0, i);
+
+    if (! (target.referenceSquares > 1.0e-12)) {
+        std::cerr << "The reference is silent" << std::endl;
+        return 1;
+    }
+
+    BandAnalyser (target.sampleRate).analyse (target.reference.getReadPointer (0), target.numSamples, target.referenceBands);
+
+    std::cout << "Matching " << String (target.numSamples / target.sampleRate, 1) << " s, reference "
+              << (lag >= 0 ? "delayed" : "early") << " by " << std::abs (lag) << " samples" << std::endl;
+
+    //======================================
+
+    Array<SearchJob> jobs;
+
+    for (int type = 0; type < DistortionAudioProcessor::distortionTypeItemsUI.size(); ++type)
+        for (int start = 0; start < numStarts; ++start)
+            jobs.add ({ type, minDrive + (maxDrive - minDrive) * (start + 0.5f) / numStarts });
+
+    Array<MatchResult> results;
+    results.resize (jobs.size());
+    std::atomic<int> nextJob { 0 };
+
+    const int64 startTicks = Time::getHighResolutionTicks();
+
+    // The processors are created here, on the main thread
+    OwnedArray<MatchWorker> workers;
+
+    for (int i = 0; i < jmin (numThreads, jobs.size()); ++i)
+        workers.add (new MatchWorker (target, jobs, nextJob, results));
+
+    for (auto* worker : workers)
+        worker->startThread();
+
+    for (auto* worker : workers)
+        worker->waitForThreadToExit (-1);
+
+    const double elapsed = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+
+    //======================================
+
+    MatchResult best;
+    int numEvaluations = 0;
+
+    for (auto& result : results)
+        numEvaluations += result.numEvaluations;
+
+    for (int type = 0; type < DistortionAudioProcessor::distortionTypeItemsUI.size(); ++type) {
+        MatchResult typeBest;
+
+        for (auto& result : results)
+            if (result.distortionType == type && result.loss < typeBest.loss)
+                typeBest = result;
+
+        std::cout << DistortionAudioProcessor::distortionTypeItemsUI[type] << ": loss " << String (typeBest.loss, 4)
+                  << " (input gain " << String (typeBest.inputGain, 1) << " dB, tone " << String (typeBest.tone, 1)
+                  << " dB, output gain " << String (typeBest.outputGain, 1) << " dB)" << std::endl;
+
+        if (typeBest.loss < best.loss)
+            best = typeBest;
+    }
+
+    std::cout << numEvaluations << " renders in " << String (elapsed, 1) << " s on " << workers.size() << " threads" << std::endl;
+
+    if (best.loss == std::numeric_limits<double>::max()) {
+        std::cerr << "No candidate produced any output" << std::endl;
+        return 1;
+    }
+
+    //======================================
+
+    DistortionAudioProcessor processor;
+    auto& parameters = processor.parameters;
+    parameters.setParameterValue ("distortiontype", (float)best.distortionType);
+    parameters.setParameterValue ("inputgain", best.inputGain);
+    parameters.setParameterValue ("tone", best.tone);
+    parameters.setParameterValue ("outputgain", jlimit (-60.0f, 24.0f, best.outputGain));
+
+    if (best.outputGain < -60.0f || best.outputGain > 24.0f)
+        std::cerr << "Warning: the level match needs " << String (best.outputGain, 1)
+                  << " dB of output gain, beyond the parameter's range" << std::endl;
+
+    outputFile.deleteFile();
+    FileOutputStream stream (outputFile);
+
+    if (! stream.openedOk()) {
+        std::cerr << "Could not write " << outputFile.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    parameters.writeBinaryState (stream);
+
+    std::cout << "Best match: " << DistortionAudioProcessor::distortionTypeItemsUI[best.distortionType]
+              << ", written to " << outputFile.getFullPathName() << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,388 @@
+/*
+  Golden-render regression suite.
+
+  Renders a fixed set of test signals through the plugin's processor, for every
+  distortion type at every parameter corner, and null-tests each render against
+  a checked-in reference:
+
+      GoldenRender [--references References] [--di excerpt.wav]
+
+  A render fails if its residual against the reference is not deep enough for
+  its model, if it contains a NaN, an Inf or a denormal, or if the realtime
+  guard had to step in. A render without a reference is skipped; the sample
+  checks still apply to it. Exit codes:
+
+      0    every render passed
+      1    at least one render failed
+      2    the tool could not run (bad arguments, unreadable files)
+      77   nothing failed, but some renders had no reference to compare with
+
+      GoldenRender --update
+
+  writes the current renders as the new references instead, refusing any that
+  would fail the sample checks. Run it on a known-good build, listen to what
+  changed, and commit the References folder with the change that caused it.
+
+  The signals are generated here, so they are bit-identical on every machine:
+  a logarithmic sine sweep, an impulse, silence, full-scale noise and a plucked
+  string standing in for a guitar DI. --di adds an excerpt of a real recording.
+*/
+
+#include <iostream>
+#include "../../../Source/PluginProcessor.h"
+
+//==============================================================================
+
+namespace
+{
+    enum
+    {
+        blockSize = 512,
+        maxDiSeconds = 4
+    };
+
+    enum ExitCode
+    {
+        exitPassed = 0,
+        exitFailed = 1,
+        exitError = 2,
+        exitSkipped = 77  // What CTest and automake treat as a skipped test
+    };
+
+    const double sampleRate = 48000.0;
+
+    //==============================================================================
+
+    struct TestSignal
+    {
+        String name;
+        AudioSampleBuffer samples;
+    };
+
+    void addSignal (Array<TestSignal>& signals, const String& name, const double seconds,
+                    std::function<float (int)> generator)
+    {
+        TestSignal signal { name, AudioSampleBuffer (1, roundToInt (seconds * sampleRate)) };
+
+        for (int i = 0; i < signal.samples.getNumSamples(); ++i)
+            signal.samples.setSample (0, i, generator (i));
+
+        signals.add (signal);
+    }
+
+    Array<TestSignal> createSignals()
+    {
+        Array<TestSignal> signals;
+
+        // Logarithmic sweep, 20 Hz to 20 kHz
+        const double sweepSeconds = 2.0;
+        const double sweepRate = std::log (20000.0 / 20.0);
+
+        addSignal (signals, "sweep", sweepSeconds, [=](int i) {
+            const double t = i / sampleRate;
+            const double phase = MathConstants<double>::twoPi * 20.0 * sweepSeconds / sweepRate
+                               * (std::exp (t * sweepRate / sweepSeconds) - 1.0);
+            return 0.5f * (float)std::sin (phase);
+        });
+
+        addSignal (signals, "impulse", 0.5, [](int i) { return i == 0 ? 1.0f : 0.0f; });
+        addSignal (signals, "silence", 1.0, [](int) { return 0.0f; });
+
+        Random noise (0x5e90d157);
+        addSignal (signals, "noise", 1.0, [&noise](int) { return 2.0f * noise.nextFloat() - 1.0f; });
+
+        // Karplus-Strong pluck of a low E, with a fixed seed for the excitation
+        Random excitation (0x0a3f17c2);
+        const int period = roundToInt (sampleRate / 82.41);
+        HeapBlock<float> string ((size_t)period);
+
+        for (int i = 0; i < period; ++i)
+            string[i] = 0.3f * (2.0f * excitation.nextFloat() - 1.0f);
+
+        addSignal (signals, "pluck", 2.0, [&string, period](int i) {
+            const int position = i % period;
+            const float out = string[position];
+            string[position] = 0.996f * 0.5f * (out + string[(position + 1) % period]);
+            return out;
+        });
+
+        return signals;
+    }
+
+    bool addDiExcerpt (Array<TestSignal>& signals, const File& file)
+    {
+        AudioFormatManager formats;
+        formats.registerBasicFormats();
+        std::unique_ptr<AudioFormatReader> reader (formats.createReaderFor (file));
+
+        if (reader == nullptr || reader->sampleRate != sampleRate) {
+            std::cerr << "Could not read " << file.getFullPathName() << " as a "
+                      << (int)sampleRate << " Hz recording" << std::endl;
+            return false;
+        }
+
+        const int numSamples = (int)jmin (reader->lengthInSamples, (int64)(maxDiSeconds * sampleRate));
+        TestSignal signal { "di", AudioSampleBuffer (1, numSamples) };
+        reader->read (&signal.samples, 0, numSamples, 0, true, false);
+        signals.add (signal);
+        return true;
+    }
+
+    //==============================================================================
+
+    struct Corner
+    {
+        const char* name;
+        float inputGain;
+        float tone;
+        bool toneStack;
+        float biasShift;
+    };
+
+    // The extremes of the drive and tone, the defaults, and everything after the shaper switched on
+    const Corner corners[] = {
+        { "clean-dark",     -24.0f, -24.0f, false,   0.0f },
+        { "clean-bright",   -24.0f,  24.0f, false,   0.0f },
+        { "hot-dark",        24.0f, -24.0f, false,   0.0f },
+        { "hot-bright",      24.0f,  24.0f, false,   0.0f },
+        { "default",         12.0f,  12.0f, false,   0.0f },
+        { "amp",             18.0f,   0.0f, true,  100.0f }
+    };
+
+    // Null depth each model has to reach against its reference, in dB. The memoryless
+    // curves only differ by rounding; the diode clipper's iterative solver and the
+    // cascaded cubics of Araya & Suyama amplify it.
+    double getTolerance (const int distortionType)
+    {
+        switch (distortionType) {
+            case DistortionAudioProcessor::distortionTypeDiodeClipper:   return -60.0;
+            case DistortionAudioProcessor::distortionTypeArayaSuyama:    return -80.0;
+            default:                                                     return -90.0;
+        }
+    }
+
+    // Residual allowed where the reference is silent
+    const float silenceTolerance = 1.0e-6f;
+
+    String getFileName (const int type, const Corner& corner, const String& signal)
+    {
+        const String typeName = DistortionAudioProcessor::distortionTypeItemsUI[type]
+                                    .retainCharacters ("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ")
+                                    .toLowerCase();
+        return String (type) + "-" + typeName + "_" + corner.name + "_" + signal + ".wav";
+    }
+
+    //==============================================================================
+
+    // Renders from a clean state, fixed profile and block sizes, so renders are repeatable
+    void render (DistortionAudioProcessor& processor, const int type, const Corner& corner,
+                 const AudioSampleBuffer& input, AudioSampleBuffer& output)
+    {
+        auto& parameters = processor.parameters;
+        parameters.setParameterValue ("distortiontype", (float)type);
+        parameters.setParameterValue ("inputgain", corner.inputGain);
+        parameters.setParameterValue ("tone", corner.tone);
+        parameters.setParameterValue ("tonestack", corner.toneStack ? 1.0f : 0.0f);
+        parameters.setParameterValue ("biasshift", corner.biasShift);
+        processor.prepareToPlay (sampleRate, blockSize);
+
+        const int numSamples = input.getNumSamples();
+        output.setSize (1, numSamples);
+
+        AudioSampleBuffer buffer (1, blockSize);
+        MidiBuffer midi;
+
+        for (int start = 0; start < numSamples; start += blockSize) {
+            const int numBlockSamples = jmin ((int)blockSize, numSamples - start);
+            buffer.setSize (1, numBlockSamples, false, false, true);
+            buffer.copyFrom (0, 0, input, 0, start, numBlockSamples);
+            processor.processBlock (buffer, midi);
+            output.copyFrom (0, start, buffer, 0, 0, numBlockSamples);
+        }
+    }
+
+    // Empty if every sample is finite and normal (or zero)
+    String checkSamples (const AudioSampleBuffer& output)
+    {
+        int numNonFinite = 0, numDenormal = 0;
+        const float* samples = output.getReadPointer (0);
+
+        for (int i = 0; i < output.getNumSamples(); ++i) {
+            if (! std::isfinite (samples[i]))
+                ++numNonFinite;
+            else if (samples[i] != 0.0f && ! std::isnormal (samples[i]))
+                ++numDenormal;
+        }
+
+        String problems;
+
+        if (numNonFinite > 0)
+            problems << numNonFinite << " non-finite samples ";
+
+        if (numDenormal > 0)
+            problems << numDenormal << " denormal samples ";
+
+        return problems.trim();
+    }
+
+    bool readReference (const File& file, AudioSampleBuffer& reference)
+    {
+        if (! file.existsAsFile())
+            return false;
+
+        WavAudioFormat wav;
+        std::unique_ptr<AudioFormatReader> reader (wav.createReaderFor (file.createInputStream().release(), true));
+
+        if (reader == nullptr)
+            return false;
+
+        reference.setSize (1, (int)reader->lengthInSamples);
+        return reader->read (&reference, 0, reference.getNumSamples(), 0, true, false);
+    }
+
+    bool writeReference (const File& file, const AudioSampleBuffer& output)
+    {
+        file.deleteFile();
+        std::unique_ptr<OutputStream> stream (file.createOutputStream());
+
+        // 32 bits are written as floats, so the references are exact
+        WavAudioFormat wav;
+        std::unique_ptr<AudioFormatWriter> writer (stream != nullptr ? wav.createWriterFor (stream.get(), sampleRate, 1, 32, {}, 0)
+                                                                     : nullptr);
+
+        if (writer == nullptr)
+            return false;
+
+        stream.release(); // Owned by the writer now
+        return writer->writeFromAudioSampleBuffer (output, 0, output.getNumSamples());
+    }
+
+    // Empty if the render nulls against the reference deeply enough
+    String compare (const AudioSampleBuffer& output, const AudioSampleBuffer& reference, const int type)
+    {
+        if (reference.getNumSamples() != output.getNumSamples())
+            return "length " + String (output.getNumSamples()) + ", reference " + String (reference.getNumSamples());
+
+        double residualSquares = 0.0, referenceSquares = 0.0;
+        float residualPeak = 0.0f;
+
+        for (int i = 0; i < output.getNumSamples(); ++i) {
+            const float r = reference.getSample (0, i);
+            const float residual = output.getSample (0, i) - r;
+            residualSquares += (double)residual * residual;
+            referenceSquares += (double)r * r;
+            residualPeak = jmax (residualPeak, std::abs (residual));
+        }
+
+        if (referenceSquares == 0.0)
+            return residualPeak <= silenceTolerance ? String() : "residual peak " + String (residualPeak) + " on silence";
+
+        const double nullDepth = 10.0 * std::log10 (jmax (residualSquares / referenceSquares, 1.0e-30));
+
+        return nullDepth <= getTolerance (type) ? String()
+             : "null depth " + String (nullDepth, 1) + " dB, needs " + String (getTolerance (type), 0) + " dB";
+    }
+}
+
+//==============================================================================
+
+int main (int argc, char* argv[])
+{
+    ScopedJuceInitialiser_GUI juceInitialiser;
+
+    StringArray arguments;
+
+    for (int i = 1; i < argc; ++i)
+        arguments.add (argv[i]);
+
+    auto getOption = [&arguments](const String& name, const String& defaultValue) {
+        const int index = arguments.indexOf (name);
+        return index >= 0 && index + 1 < arguments.size() ? arguments[index + 1] : defaultValue;
+    };
+
+    const File workingDirectory = File::getCurrentWorkingDirectory();
+    const File referenceFolder = workingDirectory.getChildFile (getOption ("--references", "References"));
+    const String diPath = getOption ("--di", {});
+    const bool update = arguments.contains ("--update");
+
+    Array<TestSignal> signals = createSignals();
+
+    if (diPath.isNotEmpty() && ! addDiExcerpt (signals, workingDirectory.getChildFile (diPath)))
+        return exitError;
+
+    if (update && ! referenceFolder.createDirectory()) {
+        std::cerr << "Could not create " << referenceFolder.getFullPathName() << std::endl;
+        return exitError;
+    }
+
+    //======================================
+
+    DistortionAudioProcessor processor;
+
+    AudioProcessor::BusesLayout layout;
+    layout.inputBuses.add (AudioChannelSet::mono());
+    layout.outputBuses.add (AudioChannelSet::mono());
+    processor.setBusesLayout (layout);
+
+    processor.setQualityProfileOverride (&DistortionAudioProcessor::realtimeProfile);
+    processor.setInternalBlockSize (DistortionAudioProcessor::defaultInternalBlockSize);
+    processor.parameters.setParameterValue ("outputgain", 0.0f);
+    processor.parameters.setParameterValue ("gatethreshold", -96.0f);
+
+    AudioSampleBuffer output, reference;
+    int numRenders = 0, numFailures = 0, numSkipped = 0;
+
+    for (int type = 0; type < DistortionAudioProcessor::distortionTypeItemsUI.size(); ++type) {
+        for (auto& corner : corners) {
+            for (auto& signal : signals) {
+                const String name = getFileName (type, corner, signal.name);
+                const auto guardBefore = processor.getGuardStatistics();
+
+                render (processor, type, corner, signal.samples, output);
+                ++numRenders;
+
+                const auto guardAfter = processor.getGuardStatistics();
+                String problems = checkSamples (output);
+
+                if (guardAfter.outputTrips != guardBefore.outputTrips || guardAfter.stateTrips != guardBefore.stateTrips)
+                    problems << (problems.isEmpty() ? "" : ", ") << "realtime guard tripped";
+
+                const File file = referenceFolder.getChildFile (name);
+
+                if (problems.isEmpty()) {
+                    if (update) {
+                        problems = writeReference (file, output) ? String() : "could not write the reference";
+                    }
+                    else if (! file.existsAsFile()) {
+                        std::cout << "SKIP " << name << ": no reference" << std::endl;
+                        ++numSkipped;
+                        continue;
+                    }
+                    else {
+                        problems = readReference (file, reference) ? compare (output, reference, type)
+                                                                   : "could not read the reference";
+                    }
+                }
+
+                if (problems.isNotEmpty()) {
+                    std::cout << "FAIL " << name << ": " << problems << std::endl;
+                    ++numFailures;
+                }
+            }
+        }
+    }
+
+    processor.releaseResources();
+
+    std::cout << (numRenders - numFailures - numSkipped) << " of " << numRenders << " renders "
+              << (update ? "written" : "passed");
+
+    if (numSkipped > 0)
+        std::cout << ", " << numSkipped << " skipped for lack of a reference (run with --update on a known-good build)";
+
+    std::cout << std::endl;
+
+    return numFailures > 0 ? exitFailed
+         : numSkipped > 0  ? exitSkipped
+                           : exitPassed;
+}
@@ -0,0 +1,78 @@
+#include "../../../Source/PluginEditor.h"
+
+//==============================================================================
+
+// Clicks are delivered straight to the widget, as the component peer would
+class MidiLearnWidgetTests : public UnitTest
+{
+public:
+    MidiLearnWidgetTests() : UnitTest ("MIDI learn widgets", "Editor") {}
+
+    void runTest() override
+    {
+        const ModifierKeys leftButton (ModifierKeys::leftButtonModifier);
+        const ModifierKeys rightButton (ModifierKeys::rightButtonModifier);
+
+        beginTest ("A right-click on a slider opens the menu and leaves the value");
+        {
+            MidiLearnWidget<Slider> slider;
+            int numMenus = 0;
+            slider.onMidiLearnMenu = [&numMenus] { ++numMenus; };
+
+            slider.setSliderStyle (Slider::LinearHorizontal);
+            slider.setTextBoxStyle (Slider::NoTextBox, false, 0, 0);
+            slider.setSliderSnapsToMousePosition (true);
+            slider.setRange (0.0, 1.0);
+            slider.setValue (0.25, dontSendNotification);
+            slider.setBounds (0, 0, 200, 20);
+            slider.setVisible (true);
+
+            click (slider, { 180.0f, 10.0f }, rightButton);
+            expectEquals (slider.getValue(), 0.25);
+            expectEquals (numMenus, 1);
+
+            // The same click with the left button does jump, so the events above did arrive
+            click (slider, { 180.0f, 10.0f }, leftButton);
+            expectGreaterThan (slider.getValue(), 0.5);
+            expectEquals (numMenus, 1);
+        }
+
+        beginTest ("A right-click on a toggle opens the menu and leaves the state");
+        {
+            MidiLearnWidget<ToggleButton> toggle;
+            int numMenus = 0;
+            toggle.onMidiLearnMenu = [&numMenus] { ++numMenus; };
+
+            toggle.setBounds (0, 0, 100, 20);
+            toggle.setVisible (true);
+
+            click (toggle, { 10.0f, 10.0f }, rightButton);
+            expect (! toggle.getToggleState());
+            expectEquals (numMenus, 1);
+
+            click (toggle, { 10.0f, 10.0f }, leftButton);
+            expect (toggle.getToggleState());
+            expectEquals (numMenus, 1);
+        }
+    }
+
+private:
+    static void click (Component& target, const Point<float> position, const ModifierKeys mods)
+    {
+        const Time now = Time::getCurrentTime();
+
+        auto makeEvent = [&](const ModifierKeys eventMods) {
+            return MouseEvent (Desktop::getInstance().getMainMouseSource(), position, eventMods,
+                               MouseInputSource::invalidPressure, MouseInputSource::invalidOrientation,
+                               MouseInputSource::invalidRotation, MouseInputSource::invalidTiltX,
+                               MouseInputSource::invalidTiltY, &target, &target, now, position, now, 1, false);
+        };
+
+        target.mouseDown (makeEvent (mods));
+        target.mouseUp (makeEvent (mods.withoutMouseButtons()));
+    }
+};
+
+static MidiLearnWidgetTests midiLearnWidgetTests;
+
+//==============================================================================
@@ -0,0 +1,45 @@
+/*
+  Unit tests for behaviour of the plugin that a render can't show: how the
+  editor's widgets treat mouse input, and how state restores interact with
+  values queued on the audio thread.
+
+      PluginTests [--category Editor]
+
+  Runs every test, or only those of one category. The exit code is 0 if they
+  all pass and 1 otherwise.
+*/
+
+#include <iostream>
+#include <JuceHeader.h>
+
+//==============================================================================
+
+int main (int argc, char* argv[])
+{
+    ScopedJuceInitialiser_GUI juceInitialiser;
+
+    StringArray arguments;
+
+    for (int i = 1; i < argc; ++i)
+        arguments.add (argv[i]);
+
+    const int categoryIndex = arguments.indexOf ("--category");
+    const String category = categoryIndex >= 0 ? arguments[categoryIndex + 1] : String();
+
+    UnitTestRunner runner;
+    runner.setAssertOnFailure (false);
+
+    if (category.isNotEmpty())
+        runner.runTestsInCategory (category);
+    else
+        runner.runAllTests();
+
+    int numFailures = 0;
+
+    for (int i = 0; i < runner.getNumResults(); ++i)
+        numFailures += runner.getResult (i)->failures;
+
+    std::cout << (numFailures == 0 ? "All tests passed" : String (numFailures) + " failures") << std::endl;
+
+    return numFailures == 0 ? 0 : 1;
+}
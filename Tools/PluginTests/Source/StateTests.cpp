@@ -0,0 +1,79 @@
+#include "../../../Source/PluginProcessor.h"
+
+//==============================================================================
+
+class StateRestoreTests : public UnitTest
+{
+public:
+    StateRestoreTests() : UnitTest ("State restore", "State") {}
+
+    void runTest() override
+    {
+        beginTest ("A restore drops a controller change queued before it");
+
+        // Both instances restore the same state; only the first had a controller
+        // change queued on the audio thread beforehand
+        DistortionAudioProcessor queued, reference;
+        MemoryBlock state;
+
+        for (auto* processor : { &queued, &reference }) {
+            processor->parameters.setParameterValue ("inputgain", restoredInputGain);
+            processor->prepareToPlay (sampleRate, blockSize);
+        }
+
+        reference.getStateInformation (state);
+
+        queued.startMidiLearn (queued.paramInputGain.index);
+        MidiBuffer controllerMove;
+        controllerMove.addEvent (MidiMessage::controllerEvent (1, 20, 127), 0);
+        process (queued, controllerMove);
+
+        for (auto* processor : { &queued, &reference })
+            processor->setStateInformation (state.getData(), (int)state.getSize());
+
+        // Audio thread: the next snapshot has the restored value, not the queued one
+        AudioSampleBuffer queuedOutput, referenceOutput;
+        MidiBuffer noMidi;
+
+        for (auto* processor : { &queued, &reference })
+            processor->prepareToPlay (sampleRate, blockSize);
+
+        process (queued, noMidi, &queuedOutput);
+        process (reference, noMidi, &referenceOutput);
+
+        for (int channel = 0; channel < queuedOutput.getNumChannels(); ++channel)
+            for (int i = 0; i < blockSize; ++i)
+                expectEquals (queuedOutput.getSample (channel, i), referenceOutput.getSample (channel, i));
+
+        // Message thread: the update the controller move triggered doesn't push it to the host either
+        MessageManager::getInstance()->runDispatchLoopUntil (50);
+        expectEquals (queued.parameters.apvts.getRawParameterValue ("inputgain")->load(), restoredInputGain);
+
+        for (auto* processor : { &queued, &reference })
+            processor->releaseResources();
+    }
+
+private:
+    enum { blockSize = 512 };
+
+    const double sampleRate = 48000.0;
+    const float restoredInputGain = -12.0f;
+
+    void process (DistortionAudioProcessor& processor, MidiBuffer& midi, AudioSampleBuffer* output = nullptr)
+    {
+        AudioSampleBuffer buffer (processor.getTotalNumOutputChannels(), blockSize);
+
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+            for (int i = 0; i < blockSize; ++i)
+                buffer.setSample (channel, i, 0.5f * (float)std::sin (MathConstants<double>::twoPi * 220.0 * i / sampleRate));
+
+        processor.processBlock (buffer, midi);
+
+        if (output != nullptr)
+            output->makeCopyOf (buffer);
+    }
+};
+
+static StateRestoreTests stateRestoreTests;
+
+//==============================================================================